@@ -19,6 +19,10 @@ export type Warning = Message & {
 export type SdlInit = {
   compiled_against_SDL_version: string;
   linked_against_SDL_version: string;
+  init_ms?: number; // SDL setup, and opening the connected controllers with init()
+  rss_bytes?: number; // resident memory right after
+  headless?: boolean;
+  async?: boolean; // started by init() on a worker thread
 };
 export type DeviceAdded = Message &
   Player & {
@@ -35,6 +39,100 @@ export type DeviceAdded = Message &
     has_gyroscope?: boolean;
     has_rumble?: boolean;
     has_rumble_trigger?: boolean;
+    probing?: boolean; // rumble and effects follow in 'controller-capabilities'
+  };
+export type OutputsApplied = {
+  written: number;
+  unchanged: number;
+  deferred: number;
+  unsupported: number;
+  failed: number;
+};
+export type HapticKeyframe = {
+  low?: number; // low frequency motor, 0 - 0xFFFF
+  high?: number; // high frequency motor
+  left?: number; // left trigger motor
+  right?: number; // right trigger motor
+  duration: number; // milliseconds
+};
+export type HapticOptions = {
+  player?: number; // defaults to all players
+  loop?: boolean | number; // true repeats until stopped, a number plays that many times
+  priority?: number; // higher priorities silence lower ones on the same controller
+  ramp?: boolean; // change smoothly from one keyframe to the next
+};
+export type TriggerEffect =
+  | { mode: 'off' }
+  // resistance from zone start (0 - 9), strength 1 - 8
+  | { mode: 'feedback'; start?: number; strength?: number }
+  // resistance from start (2 - 7) that gives way at end (up to 8)
+  | { mode: 'weapon'; start?: number; end?: number; strength?: number }
+  // amplitude 1 - 8, frequency in Hz
+  | { mode: 'vibration'; start?: number; amplitude?: number; frequency?: number };
+export type DualSenseEffects = {
+  left_trigger?: TriggerEffect;
+  right_trigger?: TriggerEffect;
+  led?: [number, number, number];
+  player_lights?: number; // one bit per light, 0 - 0x1f
+  mic_led?: 'off' | 'on' | 'pulse';
+};
+export type MappingsLoaded = Message & {
+  entries: number;
+  added: number;
+  updated: number; // replaced the mapping of a known controller
+  known: number; // already loaded, skipped
+  other_platform: number; // skipped
+  failed: number;
+  remapped: number; // open controllers whose mapping changed
+  elapsed_ms: number;
+};
+export type ReflexRule = {
+  on: string; // 'a', 'a:down', 'a:up' or an axis name with above or below
+  above?: number;
+  below?: number;
+  player?: number; // only this player's input, default every player
+  rumble?: { low?: number; high?: number; duration?: number };
+  rumble_triggers?: { left?: number; right?: number; duration?: number };
+  led?: { red?: number; green?: number; blue?: number };
+  notify?: boolean; // emit 'reflex' when it fires (default true)
+};
+export type Reflex = Player & {
+  id: number;
+  which: number;
+  button?: string;
+  pressed?: boolean;
+  axis?: string;
+  value?: number;
+  timestamp: number;
+  message?: string; // outputs SDL refused
+};
+// A button name such as 'a' or 'dpdown', a direction such as 'down-right', or presses of one step joined with '+'
+export type ComboStep = string | string[];
+export type ComboOptions = {
+  name?: string;
+  player?: number; // default every player
+  step_ms?: number; // longest wait between steps (default 200)
+  step_frames?: number; // the same in 1/60 s frames
+  chord_ms?: number; // longest time between the presses of one step (default 50)
+  chord_frames?: number;
+};
+export type Combo = Player & {
+  id: number;
+  name?: string;
+  which: number;
+  timestamp: number; // SDL timestamp of the last press
+  duration_ms: number; // from the first press
+};
+export type HapticDone = Partial<Player> & {
+  id: number;
+  which: number;
+  cancelled: boolean;
+};
+export type Capabilities = Message &
+  Player & {
+    which: number;
+    effects_supported: boolean;
+    has_rumble: boolean;
   };
 export type SensorUpdate = Message & {
   sensor: 'gyroscope' | 'accelerometer';
@@ -42,6 +140,24 @@ export type SensorUpdate = Message & {
   y: number;
   z: number;
 };
+// Samples are timestamp_us, x, y, z repeated count times
+export type SensorBatch = Player & {
+  which: number;
+  sensor: 'gyroscope' | 'accelerometer' | 'unknown';
+  rate?: number; // sensor report rate in Hz
+  output_rate?: number;
+  count: number;
+  samples: Float64Array;
+};
+// Orientation quaternion, x right, y away from the player and z up
+export type Orientation = Player & {
+  which: number;
+  w: number;
+  x: number;
+  y: number;
+  z: number;
+  calibrated: boolean; // gyroscope bias has been measured
+};
 export type SensorUpdateEvents =
   | 'controller-sensor-update'
   | 'gyroscope'
@@ -59,6 +175,75 @@ export type TouchpadUpdate = Message & {
   y: number;
   pressure: number;
 };
+export type TouchpadGesture = Player & {
+  gesture: 'tap' | 'swipe' | 'pinch' | 'scroll';
+  which: number;
+  touchpad: number;
+  fingers: number;
+  x: number;
+  y: number;
+  duration_ms: number;
+  dx?: number; // swipe and scroll
+  dy?: number;
+  scale?: number; // pinch
+  end?: boolean; // pinch and scroll
+};
+// Samples are timestamp, which, touchpad, finger, state, x, y, pressure
+// repeated count times. State is 1 down, 2 motion, 3 up.
+export type TouchpadBatch = {
+  count: number;
+  samples: Float64Array;
+};
+export type ReplayDone = Message & {
+  pushed: number;
+  skipped: number;
+};
+// buckets[i] counts values below 2 ** i, the last bucket everything larger
+export type Histogram = {
+  count: number;
+  mean: number;
+  max: number;
+  buckets: number[];
+};
+export type Stats = {
+  polls: number;
+  events: number;
+  events_by_type: Record<
+    | 'other'
+    | 'button_down'
+    | 'button_up'
+    | 'axis_motion'
+    | 'device_added'
+    | 'device_removed'
+    | 'device_remapped'
+    | 'touchpad_down'
+    | 'touchpad_motion'
+    | 'touchpad_up'
+    | 'sensor_update'
+    | 'battery_update',
+    number
+  >;
+  dropped: {
+    unsubscribed: number;
+    axis_coalesced: number;
+    axis_filtered: number;
+    poll_overruns: number;
+    filtered: number;
+    inbox_full: number;
+    sdl_queue_full: number; // process wide, never reset
+    ring_full?: number;
+  };
+  events_per_poll: Histogram;
+  poll_us: Histogram;
+  age_us: Histogram;
+  controllers: {
+    player: number;
+    which: number;
+    events: number;
+    outputs: number;
+    effects_unchanged: number;
+  }[];
+};
 export type TouchpadEvents =
   | 'controller-touchpad-down'
   | 'controller-touchpad-up'
@@ -128,6 +313,9 @@ export type BatteryUpdate = Message &
     level: BatteryLevelType;
   };
 
+// Events delivered together in batch mode carry their event name
+export type BatchedEvent = Record<string, unknown> & { event: string };
+
 export type CallBack<T = Record<string, unknown>> = (data: T) => void;
 
 type ON<TEventName, TCallBack> = (
@@ -149,6 +337,18 @@ type OnTouchpadUpdate = ON<TouchpadEvents, TouchpadUpdate>;
 type OnLed = ON<'led', Player>;
 type OnRumbled = ON<'rumbled', Player>;
 type OnRumbledTriggers = ON<'rumbled-triggers', Player>;
+type OnBatch = ON<'batch', BatchedEvent[]>;
+type OnSensorBatch = ON<'sensor-batch', SensorBatch>;
+type OnOrientation = ON<'orientation', Orientation>;
+type OnTouchpadGesture = ON<'touchpad-gesture', TouchpadGesture>;
+type OnTouchpadBatch = ON<'touchpad-batch', TouchpadBatch>;
+type OnReplayDone = ON<'replay-done', ReplayDone>;
+type OnCapabilities = ON<'controller-capabilities', Capabilities>;
+type OnOutputsApplied = ON<'outputs-applied', OutputsApplied>;
+type OnHapticDone = ON<'haptic-done', HapticDone>;
+type OnMappingsLoaded = ON<'mappings-loaded', MappingsLoaded>;
+type OnReflex = ON<'reflex', Reflex>;
+type OnCombo = ON<'combo', Combo>;
 
 type AllOnOptions = OnButtonPressCall &
   OnAxisUpdate &
@@ -163,7 +363,19 @@ type AllOnOptions = OnButtonPressCall &
   OnTouchpadUpdate &
   OnLed &
   OnRumbled &
-  OnRumbledTriggers;
+  OnRumbledTriggers &
+  OnBatch &
+  OnSensorBatch &
+  OnOrientation &
+  OnTouchpadGesture &
+  OnTouchpadBatch &
+  OnReplayDone &
+  OnCapabilities &
+  OnOutputsApplied &
+  OnHapticDone &
+  OnMappingsLoaded &
+  OnReflex &
+  OnCombo;
 
 export interface Gamecontroller extends EventEmitter {
   enableGyroscope: (enable?: boolean, player?: number) => void;
@@ -186,40 +398,283 @@ export interface Gamecontroller extends EventEmitter {
     duration_ms?: number,
     player?: number,
   ) => void;
-  pollEvents: () => void; // internal
+  pollEvents: () => number; // internal, returns events left in the queue
+  pollBatch: () => BatchedEvent[]; // internal
+  pendingEvents: () => number; // internal, events left after the last poll
+  startEventThread: () => boolean; // internal
+  subscribe: (eventName: string, subscribed?: boolean) => void;
+  setFilter: (filter?: EventFilter) => void;
+  pushEvent: (eventName: string, button: string, value?: number, count?: number) => number;
+  getState: (target?: Int16Array) => Int16Array;
+  getStats: (reset?: boolean) => Stats;
+  applyOutputs: (frame: Uint16Array, ack?: boolean) => number;
+  playHaptic: (keyframes: HapticKeyframe[], options?: HapticOptions) => number;
+  stopHaptic: (id?: number) => boolean;
+  setEffects: (effects: DualSenseEffects, player?: number) => number;
+  init: (options?: { headless?: boolean }) => Promise<SdlInit | (Message & { headless: boolean })>;
+  loadMappings: (source: string | Buffer) => number;
+  addReflex: (rule: ReflexRule) => number;
+  removeReflex: (id?: number) => boolean;
+  addCombo: (steps: ComboStep[], options?: ComboOptions) => number;
+  removeCombo: (id?: number) => boolean;
+  startRecording: (path: string) => boolean;
+  stopRecording: () => number;
+  replay: (path: string, speed?: number) => boolean;
+  stopReplay: () => void;
+  attachVirtual: () => number;
+  setVirtual: (id: number, button: string, value: number) => boolean;
+  detachVirtual: (id: number) => void;
+  getOrientation: {
+    (): Orientation[];
+    (player: number): Orientation | undefined;
+  };
+  attachRing: (ring: Int32Array) => boolean;
+  detachRing: () => void;
+  stopEventThread: () => void;
   on: AllOnOptions;
 }
 
+// One value for every axis or one per axis name
+export type AxisOption = number | Partial<Record<AxisType, number>>;
+
+// Events an instance receives from the shared event hub. Empty or missing
+// lists match everything, device events always pass.
+export type EventFilter = {
+  players?: number[];
+  devices?: number[]; // SDL joystick instance ids, 'which' on events
+  classes?: ('axis' | 'button' | 'touchpad' | 'sensor' | 'battery')[];
+};
+
 // Options interface
 export interface GameControllerOptions {
   interval?: number;
   fps?: number;
+  thread?: boolean; // wait for events on a native thread instead of polling
+  batch?: boolean; // deliver all events of a poll in one 'batch' event
+  batch_fanout?: boolean; // also emit the individual events of a batch
+  listener_aware?: boolean; // skip events nobody listens to (default false)
+  axis_coalesce?: boolean; // keep only the latest value per axis in a poll
+  axis_deadzone?: AxisOption; // values closer to rest are reported as 0
+  axis_threshold?: AxisOption; // minimum change before a value is reported
+  poll_budget_us?: number; // time one poll may take, 0 for no limit (default 100000)
+  poll_max_events?: number; // events one poll may handle, 0 for no limit
+  poll_check_every?: number; // events between clock reads (default 64)
+  sensor_stream?: boolean; // deliver sensor samples in 'sensor-batch' events
+  sensor_rate?: number; // average streamed samples down to this rate in Hz
+  sensor_fusion?: boolean; // fuse gyroscope and accelerometer natively
+  fusion_beta?: number; // filter gain, higher trusts the accelerometer more
+  orientation_rate?: number; // 'orientation' events per second (default 30)
+  touchpad_gestures?: boolean; // 'touchpad-gesture' instead of raw touchpad events
+  touchpad_raw?: boolean; // with gestures, also batch raw samples
+  filter?: EventFilter; // only receive these events
+  capability_cache?: string | boolean; // file for probed capabilities, false for none
+  output_rate?: number; // applyOutputs writes per second per controller (default 125)
+  headless?: boolean; // start SDL without video, process wide, before SDL starts
+  event_mask?: boolean; // let SDL queue only the events some controller wants (default true)
   sdl_joystick_rog_chakram?: boolean; // additional SDL options
 }
 
 // Apply EventEmitter methods to SdlGameController
 Object.setPrototypeOf(SdlGameController.prototype, EventEmitter.prototype);
 
+// Tell the native side which events have listeners so it can skip the rest
+function trackListeners(inst: Gamecontroller) {
+  inst.on('newListener', (eventName: string | symbol) => {
+    if (typeof eventName === 'string') inst.subscribe(eventName, true);
+  });
+  inst.on('removeListener', (eventName: string | symbol) => {
+    if (typeof eventName === 'string' && inst.listenerCount(eventName) === 0) {
+      inst.subscribe(eventName, false);
+    }
+  });
+}
+
 // Default export (former index.js)
 const defaultController: Gamecontroller = new SdlGameController() as Gamecontroller;
 
-setInterval(() => {
-  defaultController.pollEvents();
-}, 33);
+// Poll again right away when a poll stopped at its budget
+function pollDefault() {
+  if (defaultController.pollEvents() > 0) setImmediate(pollDefault);
+}
+setInterval(pollDefault, 33);
+
+// Shared memory event ring layout, keep in sync with src/sdlgamecontroller.h
+export const RING_HEADER_WORDS = 8;
+export const RING_RECORD_WORDS = 10;
+export const RingHeader = {
+  head: 0,
+  tail: 1,
+  capacity: 2,
+  dropped: 3,
+  recordSize: 4,
+} as const;
+export const RingEventType = {
+  buttonDown: 1,
+  buttonUp: 2,
+  axisMotion: 3,
+  deviceAdded: 4,
+  deviceRemoved: 5,
+  deviceRemapped: 6,
+  touchpadDown: 7,
+  touchpadMotion: 8,
+  touchpadUp: 9,
+  sensorUpdate: 10,
+  batteryUpdate: 11,
+} as const;
+
+// Record fields, as offsets from the start of a record
+export const RingRecord = {
+  type: 0,
+  which: 1,
+  player: 2,
+  code: 3, // button, axis, touchpad or sensor
+  value: 4, // axis value, pressed, finger or battery level
+  timestamp: 5,
+  x: 6, // float32
+  y: 7, // float32
+  z: 8, // float32 (touchpad pressure)
+} as const;
+
+export type EventRing = {
+  buffer: SharedArrayBuffer;
+  ints: Int32Array;
+  floats: Float32Array;
+  // Calls reader with the offset of each unread record, returns the count
+  drain: (reader: (ints: Int32Array, floats: Float32Array, offset: number) => void) => number;
+};
+
+// Allocate a ring for capacity - 1 records and attach it to a controller
+export function createEventRing(inst: Gamecontroller, capacity = 4096): EventRing {
+  const buffer = new SharedArrayBuffer(
+    (RING_HEADER_WORDS + capacity * RING_RECORD_WORDS) * Int32Array.BYTES_PER_ELEMENT,
+  );
+  const ints = new Int32Array(buffer);
+  const floats = new Float32Array(buffer);
+  inst.attachRing(ints);
+
+  const drain: EventRing['drain'] = (reader) => {
+    const head = Atomics.load(ints, RingHeader.head);
+    let tail = Atomics.load(ints, RingHeader.tail);
+    let count = 0;
+    while (tail !== head) {
+      reader(ints, floats, RING_HEADER_WORDS + tail * RING_RECORD_WORDS);
+      tail = (tail + 1) % capacity;
+      count++;
+    }
+    Atomics.store(ints, RingHeader.tail, tail);
+    return count;
+  };
+
+  return { buffer, ints, floats, drain };
+}
+
+// getState snapshot layout, keep in sync with src/sdlgamecontroller.h
+export const StateHeader = {
+  count: 0, // number of controller records
+  stride: 1, // words per record
+} as const;
+export const STATE_HEADER_WORDS = 2;
+
+// Record fields, as offsets from the start of a record. Axes and buttons are
+// in SDL order, the number of buttons is stride - StateRecord.buttons.
+export const StateRecord = {
+  player: 0,
+  which: 1,
+  axes: 2, // leftx, lefty, rightx, righty, lefttrigger, righttrigger
+  buttons: 8, // a, b, x, y, back, guide, start, leftstick, rightstick, ...
+} as const;
+
+// applyOutputs frame layout, keep in sync with src/sdlgamecontroller.h
+export const OutputHeader = {
+  count: 0, // number of player records
+  stride: 1, // words per record
+} as const;
+export const OUTPUT_HEADER_WORDS = 2;
+export const OUTPUT_RECORD_WORDS = 9;
+
+export const OutputRecord = {
+  player: 0,
+  flags: 1, // OutputFlags of the outputs this record sets
+  rumble_low: 2,
+  rumble_high: 3,
+  trigger_left: 4,
+  trigger_right: 5,
+  red: 6,
+  green: 7,
+  blue: 8,
+} as const;
+
+export const OutputFlags = {
+  rumble: 1,
+  triggers: 2,
+  led: 4,
+} as const;
+
+// Emit the individual events (and their aliases) of a batch
+function fanOut(inst: Gamecontroller, events: BatchedEvent[]) {
+  for (const data of events) {
+    switch (data.event) {
+      case 'controller-button-down':
+        inst.emit(`${data.button}:down`, data);
+        inst.emit(data.button as string, data);
+        break;
+      case 'controller-button-up':
+        inst.emit(`${data.button}:up`, data);
+        inst.emit(data.button as string, data);
+        break;
+      case 'controller-axis-motion':
+        inst.emit(data.button as string, data);
+        break;
+      case 'controller-sensor-update':
+        if (data.sensor !== 'unknown') inst.emit(data.sensor as string, data);
+        break;
+    }
+    inst.emit(data.event, data);
+  }
+}
 
 export function createController(options: GameControllerOptions = {}): Gamecontroller {
   console.log('createController options:', options);
-  const inst = new SdlGameController(options) as Gamecontroller;
+  // A batch without fan-out has to carry everything
+  const listener_aware =
+    options.listener_aware === true && !(options.batch && options.batch_fanout === false);
+  const inst = new SdlGameController({ ...options, listener_aware }) as Gamecontroller;
+  if (listener_aware) trackListeners(inst);
   let interval = options.interval || 33;
 
   if (options.fps) {
     interval = 1000 / options.fps;
   }
 
+  if (options.batch && options.batch_fanout !== false) {
+    inst.on('batch', (events) => fanOut(inst, events));
+  }
+
+  if (options.thread) {
+    if (inst.startEventThread()) return inst;
+    // After the caller had a chance to add listeners
+    process.nextTick(() =>
+      inst.emit('warning', {
+        message: 'thread needs SDL started headless, polling instead',
+        operation: 'startEventThread',
+      }),
+    );
+  }
+
   console.log('poll interval: ', interval, 'ms');
-  setInterval(() => {
-    inst.pollEvents();
-  }, interval);
+  // Poll again right away when a poll stopped at its budget
+  const poll = () => {
+    let pending;
+    if (options.batch) {
+      const events = inst.pollBatch();
+      if (events.length > 0) inst.emit('batch', events);
+      pending = inst.pendingEvents();
+    } else {
+      pending = inst.pollEvents();
+    }
+    if (pending > 0) setImmediate(poll);
+  };
+  setInterval(poll, interval);
 
   return inst;
 }
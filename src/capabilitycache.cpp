@@ -0,0 +1,89 @@
+#include "capabilitycache.h"
+#include <cstdio>
+
+static const char CACHE_HEADER[] = "# sdl2-gamecontroller capabilities v1";
+
+bool CapabilityCache::Open(const std::string &cachePath) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (opened)
+    return cachePath == path;
+  opened = true;
+  path = cachePath;
+  if (path.empty())
+    return true;
+
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == nullptr)
+    return true;
+
+  // vendor product version firmware caps, all hex, after the header line
+  char line[128];
+  if (fgets(line, sizeof(line), file) != nullptr
+      && std::string(line).compare(0, sizeof(CACHE_HEADER) - 1, CACHE_HEADER)
+           == 0) {
+    unsigned vendor, product, version, firmware, caps;
+    while (fscanf(file, "%x %x %x %x %x", &vendor, &product, &version,
+                  &firmware, &caps)
+           == 5) {
+      CapabilityKey key;
+      key.vendor = static_cast<Uint16>(vendor);
+      key.product = static_cast<Uint16>(product);
+      key.version = static_cast<Uint16>(version);
+      key.firmware = static_cast<Uint16>(firmware);
+      entries[key] = caps;
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+bool CapabilityCache::Lookup(const CapabilityKey &key, uint32_t *caps) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto search = entries.find(key);
+  if (search == entries.end())
+    return false;
+  *caps = search->second;
+  return true;
+}
+
+bool CapabilityCache::Claim(const CapabilityKey &key) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (entries.count(key) != 0)
+    return false;
+  return probing.insert(key).second;
+}
+
+void CapabilityCache::Release(const CapabilityKey &key) {
+  std::lock_guard<std::mutex> lock(mutex);
+  probing.erase(key);
+}
+
+void CapabilityCache::Store(const CapabilityKey &key, uint32_t caps) {
+  std::lock_guard<std::mutex> lock(mutex);
+  probing.erase(key);
+  entries[key] = caps;
+  if (path.empty())
+    return;
+
+  // Written to the side and renamed so readers never see half a file
+  std::string temp = path + ".tmp";
+  FILE *file = fopen(temp.c_str(), "w");
+  if (file == nullptr)
+    return;
+  fprintf(file, "%s\n", CACHE_HEADER);
+  for (auto &entry : entries) {
+    fprintf(file, "%04x %04x %04x %04x %x\n", entry.first.vendor,
+            entry.first.product, entry.first.version, entry.first.firmware,
+            entry.second);
+  }
+  bool written = fclose(file) == 0;
+#ifdef _WIN32
+  // rename does not replace an existing file on Windows
+  if (written)
+    std::remove(path.c_str());
+#endif
+  if (written)
+    written = std::rename(temp.c_str(), path.c_str()) == 0;
+  if (!written)
+    std::remove(temp.c_str());
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+
+// Identifies a controller model. Capabilities are the same for every
+// controller with the same key.
+struct CapabilityKey {
+  Uint16 vendor = 0;
+  Uint16 product = 0;
+  Uint16 version = 0;
+  Uint16 firmware = 0;
+
+  bool operator<(const CapabilityKey &other) const {
+    return std::tie(vendor, product, version, firmware)
+           < std::tie(other.vendor, other.product, other.version,
+                      other.firmware);
+  }
+};
+
+// Probed capabilities kept in a small text file, so a controller model is
+// only probed the first time it is seen. Shared by all instances and the
+// probe workers.
+class CapabilityCache {
+ public:
+  // Loads the file once, the first path is used by the whole process. An
+  // empty path keeps the cache in memory only. Returns false when it was
+  // already opened with another path.
+  bool Open(const std::string &path);
+  bool Lookup(const CapabilityKey &key, uint32_t *caps);
+  // True when the caller should probe the model, false when it is known
+  // or already being probed
+  bool Claim(const CapabilityKey &key);
+  // The probe found nothing out, the next controller may try again
+  void Release(const CapabilityKey &key);
+  // Stores the caps and rewrites the file
+  void Store(const CapabilityKey &key, uint32_t caps);
+
+ private:
+  std::mutex mutex;
+  bool opened = false;
+  std::string path;
+  std::map<CapabilityKey, uint32_t> entries;
+  std::set<CapabilityKey> probing;
+};
@@ -0,0 +1,201 @@
+#include "combomatcher.h"
+#include "eventhub.h"
+
+static const char *DIRECTION_NAMES[COMBO_DIRECTIONS] = {
+  "up",   "up-right",  "right", "down-right",
+  "down", "down-left", "left",  "up-left"};
+// Directions by y then x, each -1, 0 or 1. SDL's y axis points down.
+static const int DIRECTIONS[3][3] = {
+  {COMBO_UP_LEFT, COMBO_UP, COMBO_UP_RIGHT},
+  {COMBO_LEFT, -1, COMBO_RIGHT},
+  {COMBO_DOWN_LEFT, COMBO_DOWN, COMBO_DOWN_RIGHT}};
+// How far the stick has to be pushed to point somewhere
+static const Sint16 STICK_THRESHOLD = 16384;
+
+int ComboMatcher::Symbol(const std::string &name) {
+  for (int direction = 0; direction < COMBO_DIRECTIONS; direction++) {
+    if (name == DIRECTION_NAMES[direction])
+      return COMBO_DIRECTION_FIRST + direction;
+  }
+  auto button = SDL_GameControllerGetButtonFromString(name.c_str());
+  return button != SDL_CONTROLLER_BUTTON_INVALID ? button : -1;
+}
+
+const char *ComboMatcher::DirectionName(int direction) {
+  return DIRECTION_NAMES[direction];
+}
+
+int ComboMatcher::Add(const ComboPattern &pattern) {
+  bool directions = false;
+  for (auto &step : pattern.steps) {
+    for (int symbol : step)
+      directions = directions || symbol >= COMBO_DIRECTION_FIRST;
+  }
+  int id = nextId++;
+  entries.push_back({id, pattern, directions, {}});
+  return id;
+}
+
+bool ComboMatcher::Remove(int id) {
+  bool found = false;
+  for (auto entry = entries.begin(); entry != entries.end();) {
+    if (id == 0 || entry->id == id) {
+      entry = entries.erase(entry);
+      found = true;
+    } else {
+      entry++;
+    }
+  }
+  if (entries.empty())
+    sticks.clear();
+  return found;
+}
+
+void ComboMatcher::RemoveController(SDL_JoystickID which) {
+  sticks.erase(which);
+  for (auto &entry : entries)
+    entry.progress.erase(which);
+}
+
+uint32_t ComboMatcher::Classes() const {
+  uint32_t classes = 0;
+  for (auto &entry : entries) {
+    classes |= EVENT_CLASS_BUTTON;
+    // The left stick steers too
+    if (entry.directions)
+      classes |= EVENT_CLASS_AXIS;
+  }
+  return classes;
+}
+
+const ComboPattern *ComboMatcher::Find(int id) const {
+  for (auto &entry : entries) {
+    if (entry.id == id)
+      return &entry.pattern;
+  }
+  return nullptr;
+}
+
+void ComboMatcher::Feed(const SDL_Event &event, int player,
+                        std::vector<ComboMatch> *out) {
+  Uint32 now = event.common.timestamp;
+  SDL_JoystickID which;
+  switch (event.type) {
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP: {
+      which = event.cbutton.which;
+      int button = event.cbutton.button;
+      bool down = event.type == SDL_CONTROLLERBUTTONDOWN;
+      if (down)
+        Press(which, player, button, now, out);
+      if (button < SDL_CONTROLLER_BUTTON_DPAD_UP
+          || button > SDL_CONTROLLER_BUTTON_DPAD_RIGHT)
+        return;
+      uint32_t bit = 1u << (button - SDL_CONTROLLER_BUTTON_DPAD_UP);
+      Stick &stick = sticks[which];
+      stick.dpad = down ? stick.dpad | bit : stick.dpad & ~bit;
+      break;
+    }
+    case SDL_CONTROLLERAXISMOTION: {
+      which = event.caxis.which;
+      Sint16 value = event.caxis.value;
+      int position = value >= STICK_THRESHOLD    ? 1
+                     : value <= -STICK_THRESHOLD ? -1
+                                                 : 0;
+      if (event.caxis.axis == SDL_CONTROLLER_AXIS_LEFTX)
+        sticks[which].x = position;
+      else if (event.caxis.axis == SDL_CONTROLLER_AXIS_LEFTY)
+        sticks[which].y = position;
+      else
+        return;
+      break;
+    }
+    default:
+      return;
+  }
+
+  // Only a new direction is a press, holding it or letting go is not
+  int direction = Direction(which);
+  Stick &stick = sticks[which];
+  if (direction == stick.direction)
+    return;
+  stick.direction = direction;
+  if (direction >= 0)
+    Press(which, player, COMBO_DIRECTION_FIRST + direction, now, out);
+}
+
+int ComboMatcher::Direction(SDL_JoystickID which) {
+  const Stick &stick = sticks[which];
+  int x = stick.x, y = stick.y;
+  if (stick.dpad != 0) {
+    // Bits follow SDL's order: up, down, left, right
+    y = ((stick.dpad & 2) ? 1 : 0) - ((stick.dpad & 1) ? 1 : 0);
+    x = ((stick.dpad & 8) ? 1 : 0) - ((stick.dpad & 4) ? 1 : 0);
+  }
+  return DIRECTIONS[y + 1][x + 1];
+}
+
+void ComboMatcher::Press(SDL_JoystickID which, int player, int symbol,
+                         Uint32 now, std::vector<ComboMatch> *out) {
+  for (auto &entry : entries) {
+    if (entry.pattern.player != 0 && entry.pattern.player != player)
+      continue;
+    Advance(&entry, which, symbol, now, out);
+  }
+}
+
+void ComboMatcher::Advance(Entry *entry, SDL_JoystickID which, int symbol,
+                           Uint32 now, std::vector<ComboMatch> *out) {
+  const ComboPattern &pattern = entry->pattern;
+  size_t count = pattern.steps.size();
+  std::vector<Progress> &states = entry->progress[which];
+  if (states.size() != count)
+    states.assign(count, Progress());
+
+  // Last step first, so one press never moves a combo on twice. The first
+  // step is always waiting, a press there starts the combo afresh.
+  for (size_t index = count; index-- > 0;) {
+    Progress &state = states[index];
+    if (index > 0 && !state.active)
+      continue;
+    if (state.pressed != 0 && now - state.chordStart > pattern.chordMs)
+      state.pressed = 0;
+    if (index > 0 && state.pressed == 0 && now - state.done > pattern.stepMs) {
+      state.active = false;
+      continue;
+    }
+
+    const std::vector<int> &step = pattern.steps[index];
+    uint32_t bit = 0;
+    for (size_t member = 0; member < step.size(); member++) {
+      if (step[member] == symbol)
+        bit = 1u << member;
+    }
+    if (bit == 0 || (state.pressed & bit) != 0)
+      continue;
+    if (state.pressed == 0) {
+      state.chordStart = now;
+      if (index == 0)
+        state.start = now;
+    }
+    state.pressed |= bit;
+    if (state.pressed != (1u << step.size()) - 1)
+      continue;
+
+    // The step is done
+    Uint32 start = state.start;
+    state.pressed = 0;
+    state.active = false;
+    if (index + 1 == count) {
+      out->push_back({entry->id, which, start, now});
+      // Presses that led here do not count towards the next one
+      states.assign(count, Progress());
+      return;
+    }
+    Progress &next = states[index + 1];
+    next.active = true;
+    next.start = start;
+    next.done = now;
+    next.pressed = 0;
+  }
+}
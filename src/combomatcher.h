@@ -0,0 +1,94 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_gamecontroller.h>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Steps are made of symbols: a button press, or the direction of the
+// d-pad, or of the left stick when no d-pad button is held, changing
+enum ComboDirection {
+  COMBO_UP,
+  COMBO_UP_RIGHT,
+  COMBO_RIGHT,
+  COMBO_DOWN_RIGHT,
+  COMBO_DOWN,
+  COMBO_DOWN_LEFT,
+  COMBO_LEFT,
+  COMBO_UP_LEFT,
+  COMBO_DIRECTIONS
+};
+static const int COMBO_DIRECTION_FIRST = SDL_CONTROLLER_BUTTON_MAX;
+
+struct ComboPattern {
+  std::string name;
+  int player = 0;  // 0 for every player
+  // Symbols of each step, pressed together in any order
+  std::vector<std::vector<int>> steps;
+  Uint32 stepMs = 200;  // longest wait between two steps
+  Uint32 chordMs = 50;  // longest time between the presses of one step
+};
+
+struct ComboMatch {
+  int id;
+  SDL_JoystickID which;
+  Uint32 start, end;  // SDL timestamps of the first and last press
+};
+
+// Matches patterns against the input of each controller as events come
+// in, using the events' own timestamps. Every pattern keeps one state per
+// step and controller, the latest time the steps before it were done, so
+// a press costs the same however much input came before it.
+class ComboMatcher {
+ public:
+  static constexpr size_t MAX_STEPS = 32;
+  static constexpr size_t MAX_CHORD = 8;
+
+  // Symbol for 'a', 'dpup', 'down-right' and so on, -1 if unknown
+  static int Symbol(const std::string &name);
+  static const char *DirectionName(int direction);
+
+  int Add(const ComboPattern &pattern);
+  // id 0 removes every pattern. Returns false if there was nothing to remove.
+  bool Remove(int id);
+  void RemoveController(SDL_JoystickID which);
+  bool Empty() const { return entries.empty(); }
+  // Event classes the patterns look at
+  uint32_t Classes() const;
+
+  // Takes a button or axis event, appends the patterns it completes
+  void Feed(const SDL_Event &event, int player, std::vector<ComboMatch> *out);
+  const ComboPattern *Find(int id) const;
+
+ private:
+  struct Progress {
+    bool active = false;
+    Uint32 start = 0;       // first press of the combo
+    Uint32 done = 0;        // when the previous step was done
+    Uint32 chordStart = 0;  // first press of this step
+    uint32_t pressed = 0;   // presses of this step so far, one bit each
+  };
+  struct Entry {
+    int id;
+    ComboPattern pattern;
+    bool directions;
+    std::unordered_map<SDL_JoystickID, std::vector<Progress>> progress;
+  };
+  // What decides the direction of one controller
+  struct Stick {
+    uint32_t dpad = 0;
+    int x = 0, y = 0;
+    int direction = -1;
+  };
+
+  void Press(SDL_JoystickID which, int player, int symbol, Uint32 now,
+             std::vector<ComboMatch> *out);
+  void Advance(Entry *entry, SDL_JoystickID which, int symbol, Uint32 now,
+               std::vector<ComboMatch> *out);
+  int Direction(SDL_JoystickID which);
+
+  std::vector<Entry> entries;
+  std::unordered_map<SDL_JoystickID, Stick> sticks;
+  int nextId = 1;
+};
@@ -0,0 +1,52 @@
+#include "controllerregistry.h"
+#include <algorithm>
+
+ControllerRecord *ControllerRegistry::Find(SDL_JoystickID which) {
+  auto search = index.find(which);
+  if (search == index.end())
+    return nullptr;
+  return &records[search->second];
+}
+
+ControllerRecord *ControllerRegistry::Add(SDL_JoystickID which,
+                                          SDL_GameController *controller) {
+  ControllerRecord *record = Find(which);
+  if (record == nullptr) {
+    index[which] = records.size();
+    records.emplace_back();
+    record = &records.back();
+  }
+  *record = ControllerRecord();
+  record->which = which;
+  record->controller = controller;
+  return record;
+}
+
+void ControllerRegistry::Remove(SDL_JoystickID which) {
+  auto search = index.find(which);
+  if (search == index.end())
+    return;
+
+  // Keep the add order, controllers come and go rarely
+  records.erase(records.begin() + search->second);
+  index.erase(search);
+  for (size_t i = 0; i < records.size(); i++)
+    index[records[i].which] = i;
+}
+
+int ControllerRegistry::FreePlayer() const {
+  std::vector<int> players;
+  players.reserve(records.size());
+  for (auto &record : records)
+    players.push_back(record.player);
+  std::sort(players.begin(), players.end());
+
+  int player = 1;
+  for (int taken : players) {
+    if (taken == player)
+      player++;
+    else if (taken > player)
+      break;
+  }
+  return player;
+}
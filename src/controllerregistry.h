@@ -0,0 +1,83 @@
+#pragma once
+#include "ds5effects.h"
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_gamecontroller.h>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// What a controller can do, looked up once when it is opened
+enum ControllerCaps {
+  CAP_RUMBLE = 1 << 0,
+  CAP_RUMBLE_TRIGGERS = 1 << 1,
+  CAP_LED = 1 << 2,
+  CAP_GYROSCOPE = 1 << 3,
+  CAP_ACCELEROMETER = 1 << 4,
+  CAP_EFFECTS = 1 << 5,
+  CAP_HAPTIC = 1 << 6
+};
+
+// Everything the event and output paths need about one open controller,
+// so they do not have to ask SDL.
+struct ControllerRecord {
+  SDL_JoystickID which = -1;
+  SDL_GameController *controller = nullptr;
+  int player = -1;
+  uint32_t caps = 0;
+  // Capabilities SDL could answer for, the others are only found out by
+  // trying them
+  uint32_t known = 0;
+  // Waiting for the capability probe of its model
+  bool probing = false;
+  int touchpads = 0;
+
+  // Last outputs sent. Rumble stops by itself at the expiry tick, 0 when
+  // it lasts until changed.
+  Uint16 rumbleLow = 0, rumbleHigh = 0;
+  Uint16 triggerLeft = 0, triggerRight = 0;
+  Uint32 rumbleExpires = 0, triggerExpires = 0;
+  Uint8 led[3] = {0, 0, 0};
+  bool gyroscope = false;
+  bool accelerometer = false;
+
+  // Outputs wanted by applyOutputs that are not written yet
+  Uint16 wantRumble[2] = {0, 0};
+  Uint16 wantTriggers[2] = {0, 0};
+  Uint8 wantLed[3] = {0, 0, 0};
+  uint32_t dirty = 0;
+  // Outputs whose last write failed, reported once until one goes through
+  uint32_t failing = 0;
+  Uint32 lastWrite = 0;
+
+  // DualSense effects, sent as one report per poll
+  Ds5Effects ds5;
+
+  uint64_t events = 0;
+  uint64_t outputs = 0;
+  uint64_t effectsUnchanged = 0;
+
+  bool Has(uint32_t cap) const { return (caps & cap) != 0; }
+  // Outputs are only skipped when SDL said they are missing, an unknown
+  // capability is tried and SDL reports the outcome
+  bool Lacks(uint32_t cap) const { return (known & cap) != 0 && !Has(cap); }
+};
+
+// Open controllers in the order they were added, with an index by SDL
+// instance id. Lookups are O(1) and never insert. Records move when
+// controllers are added or removed, do not keep pointers across that.
+class ControllerRegistry {
+ public:
+  ControllerRecord *Find(SDL_JoystickID which);
+  ControllerRecord *Add(SDL_JoystickID which, SDL_GameController *controller);
+  void Remove(SDL_JoystickID which);
+  // Lowest player number from 1 up that no open controller has
+  int FreePlayer() const;
+
+  size_t Size() const { return records.size(); }
+  std::vector<ControllerRecord>::iterator begin() { return records.begin(); }
+  std::vector<ControllerRecord>::iterator end() { return records.end(); }
+
+ private:
+  std::vector<ControllerRecord> records;
+  std::unordered_map<SDL_JoystickID, size_t> index;
+};
@@ -0,0 +1,157 @@
+#include "ds5effects.h"
+#include <algorithm>
+
+// Effect types as the controller knows them
+static const Uint8 EFFECT_OFF = 0x05;
+static const Uint8 EFFECT_FEEDBACK = 0x21;
+static const Uint8 EFFECT_WEAPON = 0x25;
+static const Uint8 EFFECT_VIBRATION = 0x26;
+
+// Enable bits of each section, in ucEnableBits1 or ucEnableBits2
+static const Uint8 ENABLE_RIGHT_TRIGGER = 0x04;
+static const Uint8 ENABLE_LEFT_TRIGGER = 0x08;
+static const Uint8 ENABLE_MIC_LED = 0x01;
+static const Uint8 ENABLE_LED = 0x04;
+static const Uint8 ENABLE_PLAYER_LIGHTS = 0x10;
+
+static const int TRIGGER_ZONES = 10;
+
+// Sets a 3 bit level in every zone from start to the end of travel
+static void EncodeZones(Uint8 type, int start, int level, Uint8 effect[11]) {
+  Uint16 active = 0;
+  Uint32 levels = 0;
+  for (int zone = start; zone < TRIGGER_ZONES; zone++) {
+    active |= 1 << zone;
+    levels |= static_cast<Uint32>(level & 0x07) << (3 * zone);
+  }
+  effect[0] = type;
+  effect[1] = active & 0xff;
+  effect[2] = active >> 8;
+  effect[3] = levels & 0xff;
+  effect[4] = (levels >> 8) & 0xff;
+  effect[5] = (levels >> 16) & 0xff;
+  effect[6] = (levels >> 24) & 0xff;
+}
+
+void Ds5EncodeTrigger(const Ds5Trigger &trigger, Uint8 effect[11]) {
+  SDL_memset(effect, 0, 11);
+  int start = std::min(std::max(trigger.start, 0), TRIGGER_ZONES - 1);
+  int strength = std::min(std::max(trigger.strength, 1), 8);
+
+  switch (trigger.mode) {
+    case DS5_TRIGGER_FEEDBACK:
+      EncodeZones(EFFECT_FEEDBACK, start, strength - 1, effect);
+      break;
+    case DS5_TRIGGER_WEAPON: {
+      // The controller only takes a start of 2-7 and an end after it up to 8
+      int from = std::min(std::max(trigger.start, 2), 7);
+      int to = std::min(std::max(trigger.end, from + 1), 8);
+      Uint16 zones = (1 << from) | (1 << to);
+      effect[0] = EFFECT_WEAPON;
+      effect[1] = zones & 0xff;
+      effect[2] = zones >> 8;
+      effect[3] = static_cast<Uint8>(strength - 1);
+      break;
+    }
+    case DS5_TRIGGER_VIBRATION: {
+      int amplitude = std::min(std::max(trigger.amplitude, 1), 8);
+      int frequency = std::min(std::max(trigger.frequency, 1), 255);
+      EncodeZones(EFFECT_VIBRATION, start, amplitude - 1, effect);
+      effect[9] = static_cast<Uint8>(frequency);
+      break;
+    }
+    default:
+      effect[0] = EFFECT_OFF;
+      break;
+  }
+}
+
+void Ds5Effects::SetTrigger(Ds5Section section, const Ds5Trigger &trigger) {
+  if (section == DS5_RIGHT_TRIGGER)
+    Ds5EncodeTrigger(trigger, want.rgucRightTriggerEffect);
+  else
+    Ds5EncodeTrigger(trigger, want.rgucLeftTriggerEffect);
+  dirty |= section;
+}
+
+void Ds5Effects::SetLed(Uint8 red, Uint8 green, Uint8 blue) {
+  want.ucLedRed = red;
+  want.ucLedGreen = green;
+  want.ucLedBlue = blue;
+  dirty |= DS5_LED;
+}
+
+void Ds5Effects::SetPlayerLights(Uint8 lights) {
+  // Five lights, one bit each
+  want.ucPadLights = lights & 0x1f;
+  dirty |= DS5_PLAYER_LIGHTS;
+}
+
+void Ds5Effects::SetMicLed(Ds5MicLed mode) {
+  want.ucMicLightMode = static_cast<Uint8>(mode);
+  dirty |= DS5_MIC_LED;
+}
+
+bool Ds5Effects::Report(DS5EffectsState_t *report) {
+  SDL_zerop(report);
+  // A section is left out when the controller already shows it
+  auto changed = [this](Ds5Section section, const void *a, const void *b,
+                        size_t size) {
+    return (dirty & section)
+           && (!(known & section) || SDL_memcmp(a, b, size) != 0);
+  };
+
+  if (changed(DS5_RIGHT_TRIGGER, want.rgucRightTriggerEffect,
+              sent.rgucRightTriggerEffect, 11)) {
+    report->ucEnableBits1 |= ENABLE_RIGHT_TRIGGER;
+    SDL_memcpy(report->rgucRightTriggerEffect, want.rgucRightTriggerEffect,
+               11);
+  }
+  if (changed(DS5_LEFT_TRIGGER, want.rgucLeftTriggerEffect,
+              sent.rgucLeftTriggerEffect, 11)) {
+    report->ucEnableBits1 |= ENABLE_LEFT_TRIGGER;
+    SDL_memcpy(report->rgucLeftTriggerEffect, want.rgucLeftTriggerEffect, 11);
+  }
+  if (changed(DS5_LED, &want.ucLedRed, &sent.ucLedRed, 3)) {
+    report->ucEnableBits2 |= ENABLE_LED;
+    report->ucLedRed = want.ucLedRed;
+    report->ucLedGreen = want.ucLedGreen;
+    report->ucLedBlue = want.ucLedBlue;
+  }
+  if (changed(DS5_PLAYER_LIGHTS, &want.ucPadLights, &sent.ucPadLights, 1)) {
+    report->ucEnableBits2 |= ENABLE_PLAYER_LIGHTS;
+    report->ucPadLights = want.ucPadLights;
+  }
+  if (changed(DS5_MIC_LED, &want.ucMicLightMode, &sent.ucMicLightMode, 1)) {
+    report->ucEnableBits2 |= ENABLE_MIC_LED;
+    report->ucMicLightMode = want.ucMicLightMode;
+  }
+
+  dirty = 0;
+  return report->ucEnableBits1 != 0 || report->ucEnableBits2 != 0;
+}
+
+void Ds5Effects::Sent(const DS5EffectsState_t &report) {
+  if (report.ucEnableBits1 & ENABLE_RIGHT_TRIGGER) {
+    SDL_memcpy(sent.rgucRightTriggerEffect, report.rgucRightTriggerEffect, 11);
+    known |= DS5_RIGHT_TRIGGER;
+  }
+  if (report.ucEnableBits1 & ENABLE_LEFT_TRIGGER) {
+    SDL_memcpy(sent.rgucLeftTriggerEffect, report.rgucLeftTriggerEffect, 11);
+    known |= DS5_LEFT_TRIGGER;
+  }
+  if (report.ucEnableBits2 & ENABLE_LED) {
+    sent.ucLedRed = report.ucLedRed;
+    sent.ucLedGreen = report.ucLedGreen;
+    sent.ucLedBlue = report.ucLedBlue;
+    known |= DS5_LED;
+  }
+  if (report.ucEnableBits2 & ENABLE_PLAYER_LIGHTS) {
+    sent.ucPadLights = report.ucPadLights;
+    known |= DS5_PLAYER_LIGHTS;
+  }
+  if (report.ucEnableBits2 & ENABLE_MIC_LED) {
+    sent.ucMicLightMode = report.ucMicLightMode;
+    known |= DS5_MIC_LED;
+  }
+}
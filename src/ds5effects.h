@@ -0,0 +1,82 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstdint>
+
+/* PS5 trigger effect documentation:
+   https://controllers.fandom.com/wiki/Sony_DualSense#FFB_Trigger_Modes
+*/
+typedef struct {
+  Uint8 ucEnableBits1;              /* 0 */
+  Uint8 ucEnableBits2;              /* 1 */
+  Uint8 ucRumbleRight;              /* 2 */
+  Uint8 ucRumbleLeft;               /* 3 */
+  Uint8 ucHeadphoneVolume;          /* 4 */
+  Uint8 ucSpeakerVolume;            /* 5 */
+  Uint8 ucMicrophoneVolume;         /* 6 */
+  Uint8 ucAudioEnableBits;          /* 7 */
+  Uint8 ucMicLightMode;             /* 8 */
+  Uint8 ucAudioMuteBits;            /* 9 */
+  Uint8 rgucRightTriggerEffect[11]; /* 10 */
+  Uint8 rgucLeftTriggerEffect[11];  /* 21 */
+  Uint8 rgucUnknown1[6];            /* 32 */
+  Uint8 ucLedFlags;                 /* 38 */
+  Uint8 rgucUnknown2[2];            /* 39 */
+  Uint8 ucLedAnim;                  /* 41 */
+  Uint8 ucLedBrightness;            /* 42 */
+  Uint8 ucPadLights;                /* 43 */
+  Uint8 ucLedRed;                   /* 44 */
+  Uint8 ucLedGreen;                 /* 45 */
+  Uint8 ucLedBlue;                  /* 46 */
+} DS5EffectsState_t;
+
+// Parts of the report that are only applied when their enable bit is set
+enum Ds5Section {
+  DS5_RIGHT_TRIGGER = 1 << 0,
+  DS5_LEFT_TRIGGER = 1 << 1,
+  DS5_LED = 1 << 2,
+  DS5_PLAYER_LIGHTS = 1 << 3,
+  DS5_MIC_LED = 1 << 4
+};
+
+enum Ds5TriggerMode {
+  DS5_TRIGGER_OFF = 0,
+  DS5_TRIGGER_FEEDBACK,   // resistance from start to the end of travel
+  DS5_TRIGGER_WEAPON,     // resistance from start that snaps at end
+  DS5_TRIGGER_VIBRATION,  // vibrates from start to the end of travel
+};
+
+enum Ds5MicLed { DS5_MIC_OFF = 0, DS5_MIC_ON = 1, DS5_MIC_PULSE = 2 };
+
+// Positions are zones 0-9 along the trigger travel, strength and amplitude
+// 1-8 and frequency in Hz. Out of range values are clamped.
+struct Ds5Trigger {
+  Ds5TriggerMode mode = DS5_TRIGGER_OFF;
+  int start = 0;
+  int end = 0;
+  int strength = 0;
+  int amplitude = 0;
+  int frequency = 0;
+};
+
+// Encodes a trigger effect into the 11 bytes the report carries for it
+void Ds5EncodeTrigger(const Ds5Trigger &trigger, Uint8 effect[11]);
+
+// The effects wanted for one DualSense and the ones it last got. Changes
+// are collected until Report builds a single report out of them.
+struct Ds5Effects {
+  DS5EffectsState_t want = {};
+  DS5EffectsState_t sent = {};
+  uint32_t dirty = 0;  // sections changed since the last report
+  uint32_t known = 0;  // sections the controller is known to show
+
+  void SetTrigger(Ds5Section section, const Ds5Trigger &trigger);
+  void SetLed(Uint8 red, Uint8 green, Uint8 blue);
+  void SetPlayerLights(Uint8 lights);
+  void SetMicLed(Ds5MicLed mode);
+
+  // Takes the changed sections that differ from what was sent into the
+  // report. Returns false when there is nothing to send.
+  bool Report(DS5EffectsState_t *report);
+  // Remembers a report the controller accepted
+  void Sent(const DS5EffectsState_t &report);
+};
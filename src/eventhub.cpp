@@ -0,0 +1,393 @@
+#include "eventhub.h"
+#include <algorithm>
+
+// Controller event types by the class a filter selects them with
+static const struct {
+  Uint32 type;
+  uint32_t eventClass;
+} CLASS_TYPES[] = {
+  {SDL_CONTROLLERAXISMOTION, EVENT_CLASS_AXIS},
+  {SDL_CONTROLLERBUTTONDOWN, EVENT_CLASS_BUTTON},
+  {SDL_CONTROLLERBUTTONUP, EVENT_CLASS_BUTTON},
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  {SDL_CONTROLLERTOUCHPADDOWN, EVENT_CLASS_TOUCHPAD},
+  {SDL_CONTROLLERTOUCHPADMOTION, EVENT_CLASS_TOUCHPAD},
+  {SDL_CONTROLLERTOUCHPADUP, EVENT_CLASS_TOUCHPAD},
+  {SDL_CONTROLLERSENSORUPDATE, EVENT_CLASS_SENSOR},
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 24)
+  {SDL_JOYBATTERYUPDATED, EVENT_CLASS_BATTERY},
+#endif
+};
+
+// Events no consumer does anything with. Joystick events stay, SDL makes
+// the controller events out of them.
+static const Uint32 OTHER_TYPES[] = {
+  SDL_WINDOWEVENT,
+  SDL_SYSWMEVENT,
+  SDL_TEXTEDITING,
+  SDL_TEXTINPUT,
+  SDL_MOUSEMOTION,
+  SDL_MOUSEBUTTONDOWN,
+  SDL_MOUSEBUTTONUP,
+  SDL_MOUSEWHEEL,
+  SDL_FINGERDOWN,
+  SDL_FINGERUP,
+  SDL_FINGERMOTION,
+  SDL_DOLLARGESTURE,
+  SDL_DOLLARRECORD,
+  SDL_MULTIGESTURE,
+  SDL_CLIPBOARDUPDATE,
+  SDL_DROPFILE,
+  SDL_RENDER_TARGETS_RESET,
+#if SDL_VERSION_ATLEAST(2, 0, 4)
+  SDL_KEYMAPCHANGED,
+  SDL_AUDIODEVICEADDED,
+  SDL_AUDIODEVICEREMOVED,
+  SDL_RENDER_DEVICE_RESET,
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 5)
+  SDL_DROPTEXT,
+  SDL_DROPBEGIN,
+  SDL_DROPCOMPLETE,
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 9)
+  SDL_DISPLAYEVENT,
+  SDL_SENSORUPDATE,
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  SDL_LOCALECHANGED,
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 22)
+  SDL_TEXTEDITING_EXT,
+#endif
+};
+
+// The number goes at the end of the event, past every controller event.
+// Only the event itself is copied into SDL's queue, so that is the one
+// place the number can travel with it. A side table keyed by timestamp and
+// which cannot tell apart the many events one controller sends within a
+// millisecond, and would need a lock on SDL's thread and entries cleaned
+// up for the very events that get dropped.
+static const size_t STAMP_OFFSET = sizeof(SDL_Event) - sizeof(uint64_t);
+static_assert(sizeof(SDL_CommonEvent) <= STAMP_OFFSET,
+              "SDL_CommonEvent overlaps the stamp");
+static_assert(sizeof(SDL_ControllerAxisEvent) <= STAMP_OFFSET,
+              "SDL_ControllerAxisEvent overlaps the stamp");
+static_assert(sizeof(SDL_ControllerButtonEvent) <= STAMP_OFFSET,
+              "SDL_ControllerButtonEvent overlaps the stamp");
+static_assert(sizeof(SDL_ControllerDeviceEvent) <= STAMP_OFFSET,
+              "SDL_ControllerDeviceEvent overlaps the stamp");
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+static_assert(sizeof(SDL_ControllerTouchpadEvent) <= STAMP_OFFSET,
+              "SDL_ControllerTouchpadEvent overlaps the stamp");
+static_assert(sizeof(SDL_ControllerSensorEvent) <= STAMP_OFFSET,
+              "SDL_ControllerSensorEvent overlaps the stamp");
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 24)
+static_assert(sizeof(SDL_JoyBatteryEvent) <= STAMP_OFFSET,
+              "SDL_JoyBatteryEvent overlaps the stamp");
+#endif
+// Time between the two checks that make a missing number a drop, far
+// longer than a thread takes from numbering an event to queueing it
+static const Uint32 SETTLE_MS = 10;
+// Missing numbers tracked one by one, more are counted as dropped
+static const size_t MISSING_LIMIT = 65536;
+
+static bool Numbered(Uint32 type) {
+  if (type == SDL_CONTROLLERDEVICEADDED || type == SDL_CONTROLLERDEVICEREMOVED)
+    return true;
+  for (auto &entry : CLASS_TYPES) {
+    if (entry.type == type)
+      return true;
+  }
+  return false;
+}
+
+static uint64_t StampOf(const SDL_Event &event) {
+  uint64_t stamp;
+  SDL_memcpy(&stamp, event.padding + STAMP_OFFSET, sizeof(stamp));
+  return stamp;
+}
+
+bool HubFilter::Accepts(const SDL_Event &event) const {
+  SDL_JoystickID which;
+  uint32_t eventClass;
+  switch (event.type) {
+    case SDL_CONTROLLERAXISMOTION:
+      which = event.caxis.which;
+      eventClass = EVENT_CLASS_AXIS;
+      break;
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+      which = event.cbutton.which;
+      eventClass = EVENT_CLASS_BUTTON;
+      break;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    case SDL_CONTROLLERTOUCHPADDOWN:
+    case SDL_CONTROLLERTOUCHPADMOTION:
+    case SDL_CONTROLLERTOUCHPADUP:
+      which = event.ctouchpad.which;
+      eventClass = EVENT_CLASS_TOUCHPAD;
+      break;
+    case SDL_CONTROLLERSENSORUPDATE:
+      which = event.csensor.which;
+      eventClass = EVENT_CLASS_SENSOR;
+      break;
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 24)
+    case SDL_JOYBATTERYUPDATED:
+      which = event.jbattery.which;
+      eventClass = EVENT_CLASS_BATTERY;
+      break;
+#endif
+    default:
+      return true;
+  }
+
+  if ((classes & eventClass) == 0)
+    return false;
+  if (!devices.empty() && devices.count(which) == 0)
+    return false;
+  if (!players.empty()) {
+#if SDL_VERSION_ATLEAST(2, 0, 12)
+    SDL_Joystick *joystick = SDL_JoystickFromInstanceID(which);
+    if (joystick == nullptr
+        || players.count(SDL_JoystickGetPlayerIndex(joystick)) == 0)
+      return false;
+#endif
+  }
+  return true;
+}
+
+EventHub &EventHub::Instance() {
+  static EventHub hub;
+  return hub;
+}
+
+EventHub::~EventHub() {
+  running = false;
+  if (thread.joinable())
+    thread.join();
+  if (attached)
+    SDL_DelEventWatch(&EventHub::Stamp, this);
+}
+
+void EventHub::Register(HubConsumer *consumer) {
+  std::lock_guard<std::mutex> lock(mutex);
+  consumers.push_back(consumer);
+  ApplyMask();
+}
+
+void EventHub::Unregister(HubConsumer *consumer) {
+  StopThread(consumer);
+  std::lock_guard<std::mutex> lock(mutex);
+  consumers.erase(std::remove(consumers.begin(), consumers.end(), consumer),
+                  consumers.end());
+  ApplyMask();
+}
+
+void EventHub::SetFilter(HubConsumer *consumer, const HubFilter &filter) {
+  std::lock_guard<std::mutex> lock(mutex);
+  consumer->filter = filter;
+  ApplyMask();
+}
+
+void EventHub::SetWanted(HubConsumer *consumer, uint32_t classes,
+                         uint32_t inspected) {
+  std::lock_guard<std::mutex> lock(mutex);
+  consumer->wanted = classes;
+  consumer->inspected = inspected;
+  ApplyMask();
+}
+
+size_t EventHub::Pump(size_t max) {
+  if (running)
+    return 0;
+  SDL_Event event;
+  size_t count = 0;
+  while (count < max && SDL_PollEvent(&event)) {
+    Dispatch(event);
+    count++;
+  }
+  if (count < max) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Settle();
+  }
+  return count;
+}
+
+void EventHub::Dispatch(const SDL_Event &event) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (attached && Numbered(event.type)) {
+    uint64_t stamp = StampOf(event);
+    if (stamp != 0)
+      Taken(stamp);
+  }
+  for (auto consumer : consumers) {
+    if (consumer->inspect)
+      consumer->inspect(event);
+    if (!consumer->filter.Accepts(event)) {
+      consumer->filtered++;
+      continue;
+    }
+    if (consumer->inbox.size() >= INBOX_LIMIT) {
+      consumer->overflowed++;
+      continue;
+    }
+    consumer->inbox.push_back(event);
+    // One wake up per batch, the consumer takes whatever has queued up
+    if (consumer->wake && consumer->inbox.size() == 1)
+      consumer->wake();
+  }
+}
+
+void EventHub::Take(HubConsumer *consumer, std::vector<SDL_Event> *out) {
+  std::lock_guard<std::mutex> lock(mutex);
+  out->insert(out->end(), consumer->inbox.begin(), consumer->inbox.end());
+  consumer->inbox.clear();
+}
+
+size_t EventHub::Queued(HubConsumer *consumer) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return consumer->inbox.size();
+}
+
+void EventHub::StartThread(HubConsumer *consumer, std::function<void()> wake) {
+  std::lock_guard<std::mutex> lock(mutex);
+  consumer->wake = wake;
+  if (!running) {
+    running = true;
+    thread = std::thread(&EventHub::Run, this);
+  }
+  // Events that arrived before the thread was asked for
+  if (!consumer->inbox.empty())
+    consumer->wake();
+}
+
+void EventHub::StopThread(HubConsumer *consumer) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!consumer->wake)
+      return;
+    // After this the thread can no longer call into the consumer
+    consumer->wake = nullptr;
+    for (auto other : consumers) {
+      if (other->wake)
+        return;
+    }
+    running = false;
+  }
+  // Dispatch takes the lock, join without it
+  if (thread.joinable())
+    thread.join();
+}
+
+void EventHub::Run() {
+  SDL_Event event;
+  while (running) {
+    // Wake up now and then to check if we have been asked to stop
+    if (SDL_WaitEventTimeout(&event, 100))
+      Dispatch(event);
+    if (SDL_PeepEvents(nullptr, 0, SDL_PEEKEVENT, SDL_FIRSTEVENT,
+                       SDL_LASTEVENT)
+        == 0) {
+      std::lock_guard<std::mutex> lock(mutex);
+      Settle();
+    }
+  }
+}
+
+void EventHub::Attach(bool keyboard, bool mask) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (attached)
+    return;
+  attached = true;
+  masked = mask;
+
+  if (!keyboard) {
+    SDL_EventState(SDL_KEYDOWN, SDL_IGNORE);
+    SDL_EventState(SDL_KEYUP, SDL_IGNORE);
+  }
+  if (masked) {
+    for (auto type : OTHER_TYPES)
+      SDL_EventState(type, SDL_IGNORE);
+  }
+  ApplyMask();
+  SDL_AddEventWatch(&EventHub::Stamp, this);
+}
+
+uint64_t EventHub::Lost() const {
+  return lost;
+}
+
+void EventHub::Taken(uint64_t stamp) {
+  if (stamp < nextStamp) {
+    // Queued late by a slower thread
+    missing.erase(stamp);
+    return;
+  }
+  for (uint64_t gap = nextStamp; gap < stamp; gap++) {
+    if (missing.size() >= MISSING_LIMIT) {
+      lost += stamp - gap;
+      break;
+    }
+    missing.insert(gap);
+  }
+  nextStamp = stamp + 1;
+}
+
+// Called with the queue found empty. Numbers missing the last time too
+// can no longer come.
+void EventHub::Settle() {
+  Uint32 now = SDL_GetTicks();
+  if (now - settledAt < SETTLE_MS)
+    return;
+  settledAt = now;
+  for (uint64_t stamp : suspect)
+    lost += missing.erase(stamp);
+  suspect = missing;
+}
+
+void EventHub::ApplyMask() {
+  if (!attached || !masked)
+    return;
+  uint32_t classes = 0;
+  for (auto consumer : consumers)
+    classes |= (consumer->filter.classes & consumer->wanted)
+               | consumer->inspected;
+  if (classes == enabledClasses)
+    return;
+
+  for (auto &entry : CLASS_TYPES) {
+    bool enable = (classes & entry.eventClass) != 0;
+    if (enable == ((enabledClasses & entry.eventClass) != 0))
+      continue;
+    if (!enable) {
+      // Turning a type off drops what is queued, which is not a loss
+      int queued = SDL_PeepEvents(nullptr, 0, SDL_PEEKEVENT, entry.type,
+                                  entry.type);
+      if (queued > 0) {
+        std::vector<SDL_Event> dropped(queued);
+        queued = SDL_PeepEvents(dropped.data(), queued, SDL_PEEKEVENT,
+                                entry.type, entry.type);
+        for (int i = 0; i < queued; i++)
+          Taken(StampOf(dropped[i]));
+      }
+    }
+    SDL_EventState(entry.type, enable ? SDL_ENABLE : SDL_IGNORE);
+  }
+  enabledClasses = classes;
+}
+
+// Runs on the thread that queues the event, before it is queued
+int SDLCALL EventHub::Stamp(void *userdata, SDL_Event *event) {
+  // Ignored types are not queued, do not leave a gap for them
+  if (Numbered(event->type)
+      && SDL_EventState(event->type, SDL_QUERY) == SDL_ENABLE) {
+    auto hub = static_cast<EventHub *>(userdata);
+    uint64_t stamp = ++hub->stamped;
+    SDL_memcpy(event->padding + STAMP_OFFSET, &stamp, sizeof(stamp));
+  }
+  return 1;
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Event classes a consumer can filter on
+enum EventClass {
+  EVENT_CLASS_AXIS = 1 << 0,
+  EVENT_CLASS_BUTTON = 1 << 1,
+  EVENT_CLASS_TOUCHPAD = 1 << 2,
+  EVENT_CLASS_SENSOR = 1 << 3,
+  EVENT_CLASS_BATTERY = 1 << 4,
+  EVENT_CLASS_ALL = (1 << 5) - 1
+};
+
+// Which events a consumer gets. Empty sets match everything. Device added,
+// removed and remapped events always pass, they change the consumer's state.
+struct HubFilter {
+  std::set<int> players;
+  std::set<SDL_JoystickID> devices;
+  uint32_t classes = EVENT_CLASS_ALL;
+
+  bool Accepts(const SDL_Event &event) const;
+};
+
+// One receiver of hub events, usually an SdlGameController instance. The
+// filter, inbox and wake callback are guarded by the hub.
+struct HubConsumer {
+  HubFilter filter;
+  // Classes the consumer has a use for right now, for the SDL event mask
+  uint32_t wanted = EVENT_CLASS_ALL;
+  // Classes inspect looks at, kept unmasked whatever the filter says
+  uint32_t inspected = 0;
+  std::vector<SDL_Event> inbox;
+  std::atomic<uint64_t> filtered{0};
+  std::atomic<uint64_t> overflowed{0};
+  // Called from the hub thread when the inbox stops being empty
+  std::function<void()> wake;
+  // Called from the thread that drains SDL with every event, before the
+  // filter. Set before Register.
+  std::function<void(const SDL_Event &)> inspect;
+};
+
+// Drains the SDL queue once for every consumer in the process. Each event
+// is copied into the inbox of every consumer whose filter takes it, so
+// instances no longer take events from each other and the SDL side costs
+// the same however many there are. The queue is drained either by whoever
+// calls Pump or by one thread shared by all consumers that want it.
+class EventHub {
+ public:
+  // Inboxes of consumers that stop taking events are capped at this size,
+  // what comes after is counted as overflowed
+  static constexpr size_t INBOX_LIMIT = 65536;
+
+  static EventHub &Instance();
+  ~EventHub();
+
+  void Register(HubConsumer *consumer);
+  void Unregister(HubConsumer *consumer);
+  void SetFilter(HubConsumer *consumer, const HubFilter &filter);
+  void SetWanted(HubConsumer *consumer, uint32_t classes,
+                 uint32_t inspected = 0);
+
+  // Takes up to max events from SDL and hands them out. Returns how many
+  // were taken. Takes nothing while the hub thread runs, SDL must only be
+  // pumped from one thread.
+  size_t Pump(size_t max);
+  // Appends the consumer's inbox to out and empties it
+  void Take(HubConsumer *consumer, std::vector<SDL_Event> *out);
+  size_t Queued(HubConsumer *consumer);
+
+  // The thread runs while at least one consumer has a wake callback
+  void StartThread(HubConsumer *consumer, std::function<void()> wake);
+  void StopThread(HubConsumer *consumer);
+  bool Threaded() const { return running; }
+
+  // Called once SDL is up. Keeps event types nobody reads out of the SDL
+  // queue: always the keyboard when it is not wanted, with mask also
+  // window, mouse, text and other non controller events, and the
+  // controller event classes no consumer wants or lets through its
+  // filter. Starts counting events SDL drops because its queue is full.
+  void Attach(bool keyboard, bool mask);
+  // Controller events SDL could not queue since Attach
+  uint64_t Lost() const;
+
+ private:
+  EventHub() = default;
+  void Dispatch(const SDL_Event &event);
+  void Run();
+  void ApplyMask();
+  void Taken(uint64_t stamp);
+  void Settle();
+  static int SDLCALL Stamp(void *userdata, SDL_Event *event);
+
+  std::mutex mutex;
+  std::vector<HubConsumer *> consumers;
+  std::thread thread;
+  std::atomic<bool> running{false};
+
+  // Controller events are numbered as SDL queues them. Threads queueing at
+  // the same time can queue them out of order, so a skipped number only
+  // counts as dropped when it is still missing at two checks of an empty
+  // queue some time apart.
+  bool attached = false;
+  bool masked = false;
+  uint32_t enabledClasses = EVENT_CLASS_ALL;
+  std::atomic<uint64_t> stamped{0};
+  uint64_t nextStamp = 1;
+  std::set<uint64_t> missing;
+  std::set<uint64_t> suspect;
+  Uint32 settledAt = 0;
+  std::atomic<uint64_t> lost{0};
+};
@@ -0,0 +1,247 @@
+#include "eventtrace.h"
+#include <SDL2/SDL_events.h>
+#include <cerrno>
+#include <cstring>
+
+static const char TRACE_MAGIC[8] = {'S', 'D', 'L', 'G', 'C', 'T', 'R', 'C'};
+static const uint32_t TRACE_VERSION = 1;
+
+bool TraceRecordFromEvent(const SDL_Event &event, uint64_t time,
+                          TraceRecord *record) {
+  SDL_zerop(record);
+  record->time = time;
+  record->type = event.type;
+
+  switch (event.type) {
+    case SDL_CONTROLLERAXISMOTION:
+      record->which = event.caxis.which;
+      record->code = event.caxis.axis;
+      record->value = event.caxis.value;
+      return true;
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+      record->which = event.cbutton.which;
+      record->code = event.cbutton.button;
+      record->value = event.cbutton.state;
+      return true;
+    case SDL_CONTROLLERDEVICEADDED:
+    case SDL_CONTROLLERDEVICEREMOVED:
+    case SDL_CONTROLLERDEVICEREMAPPED:
+      record->which = event.cdevice.which;
+      return true;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    case SDL_CONTROLLERTOUCHPADDOWN:
+    case SDL_CONTROLLERTOUCHPADMOTION:
+    case SDL_CONTROLLERTOUCHPADUP:
+      record->which = event.ctouchpad.which;
+      record->code = event.ctouchpad.touchpad;
+      record->value = event.ctouchpad.finger;
+      record->data[0] = event.ctouchpad.x;
+      record->data[1] = event.ctouchpad.y;
+      record->data[2] = event.ctouchpad.pressure;
+      return true;
+    case SDL_CONTROLLERSENSORUPDATE:
+      record->which = event.csensor.which;
+      record->code = event.csensor.sensor;
+      SDL_memcpy(record->data, event.csensor.data, 3 * sizeof(float));
+      return true;
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 24)
+    case SDL_JOYBATTERYUPDATED:
+      record->which = event.jbattery.which;
+      record->value = event.jbattery.level;
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+void TraceRecordToEvent(const TraceRecord &record, SDL_Event *event) {
+  SDL_zerop(event);
+  event->type = record.type;
+
+  switch (record.type) {
+    case SDL_CONTROLLERAXISMOTION:
+      event->caxis.which = record.which;
+      event->caxis.axis = static_cast<Uint8>(record.code);
+      event->caxis.value = static_cast<Sint16>(record.value);
+      break;
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+      event->cbutton.which = record.which;
+      event->cbutton.button = static_cast<Uint8>(record.code);
+      event->cbutton.state = static_cast<Uint8>(record.value);
+      break;
+    case SDL_CONTROLLERDEVICEADDED:
+    case SDL_CONTROLLERDEVICEREMOVED:
+    case SDL_CONTROLLERDEVICEREMAPPED:
+      event->cdevice.which = record.which;
+      break;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    case SDL_CONTROLLERTOUCHPADDOWN:
+    case SDL_CONTROLLERTOUCHPADMOTION:
+    case SDL_CONTROLLERTOUCHPADUP:
+      event->ctouchpad.which = record.which;
+      event->ctouchpad.touchpad = record.code;
+      event->ctouchpad.finger = record.value;
+      event->ctouchpad.x = record.data[0];
+      event->ctouchpad.y = record.data[1];
+      event->ctouchpad.pressure = record.data[2];
+      break;
+    case SDL_CONTROLLERSENSORUPDATE:
+      event->csensor.which = record.which;
+      event->csensor.sensor = record.code;
+      SDL_memcpy(event->csensor.data, record.data, 3 * sizeof(float));
+      break;
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 24)
+    case SDL_JOYBATTERYUPDATED:
+      event->jbattery.which = record.which;
+      event->jbattery.level = static_cast<SDL_JoystickPowerLevel>(record.value);
+      break;
+#endif
+  }
+}
+
+bool TraceWriter::Open(const std::string &path) {
+  Close();
+  error.clear();
+
+  file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    error = path + ": " + std::strerror(errno);
+    return false;
+  }
+  // Records are small, write them out in large chunks
+  setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+  TraceHeader header;
+  SDL_zero(header);
+  SDL_memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header.version = TRACE_VERSION;
+  header.recordSize = sizeof(TraceRecord);
+  if (fwrite(&header, sizeof(header), 1, file) != 1) {
+    error = path + ": " + std::strerror(errno);
+    fclose(file);
+    file = nullptr;
+    return false;
+  }
+
+  start = SDL_GetTicks();
+  count = 0;
+  return true;
+}
+
+void TraceWriter::Write(const SDL_Event &event) {
+  if (file == nullptr)
+    return;
+
+  // Events queued before the recording started are put at its start
+  Sint32 elapsed = static_cast<Sint32>(event.common.timestamp - start);
+  uint64_t time = elapsed > 0 ? elapsed * 1000ull : 0;
+
+  TraceRecord record;
+  if (!TraceRecordFromEvent(event, time, &record))
+    return;
+
+  if (fwrite(&record, sizeof(record), 1, file) != 1) {
+    error = std::strerror(errno);
+    fclose(file);
+    file = nullptr;
+    return;
+  }
+  count++;
+}
+
+uint64_t TraceWriter::Close() {
+  if (file != nullptr) {
+    fclose(file);
+    file = nullptr;
+  }
+  return count;
+}
+
+bool TraceReplayer::Start(const std::string &path, double replaySpeed) {
+  Stop();
+  error.clear();
+
+  if (!trace.Open(path)) {
+    error = trace.Error();
+    return false;
+  }
+
+  TraceHeader header;
+  if (trace.Size() < sizeof(header)) {
+    error = path + ": not a trace file";
+    trace.Close();
+    return false;
+  }
+  SDL_memcpy(&header, trace.Data(), sizeof(header));
+  if (SDL_memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+      || header.version != TRACE_VERSION
+      || header.recordSize != sizeof(TraceRecord)) {
+    error = path + ": not a trace file or an unsupported version";
+    trace.Close();
+    return false;
+  }
+
+  speed = replaySpeed;
+  pushed = 0;
+  skipped = 0;
+  finished = false;
+  running = true;
+  thread = std::thread(&TraceReplayer::Replay, this);
+  return true;
+}
+
+void TraceReplayer::Stop() {
+  running = false;
+  if (thread.joinable())
+    thread.join();
+}
+
+void TraceReplayer::Replay() {
+  const uint8_t *records = trace.Data() + sizeof(TraceHeader);
+  size_t total = (trace.Size() - sizeof(TraceHeader)) / sizeof(TraceRecord);
+  Uint64 frequency = SDL_GetPerformanceFrequency();
+  Uint64 begin = SDL_GetPerformanceCounter();
+
+  for (size_t i = 0; i < total && running; i++) {
+    // Records may not be aligned in the mapping
+    TraceRecord record;
+    SDL_memcpy(&record, records + i * sizeof(TraceRecord), sizeof(record));
+
+    // Sleep in short steps so Stop does not have to wait for long gaps
+    while (speed > 0 && running) {
+      double elapsed = (SDL_GetPerformanceCounter() - begin) * 1e6 / frequency;
+      double wait = record.time / speed - elapsed;
+      if (wait < 1000)
+        break;
+      SDL_Delay(wait > 10000 ? 10 : static_cast<Uint32>(wait / 1000));
+    }
+
+    switch (record.type) {
+      case SDL_CONTROLLERDEVICEADDED:
+      case SDL_CONTROLLERDEVICEREMOVED:
+      case SDL_CONTROLLERDEVICEREMAPPED:
+        skipped++;
+        continue;
+    }
+
+    SDL_Event event;
+    TraceRecordToEvent(record, &event);
+    int result;
+    // The queue is full, give the poller a chance to catch up
+    while ((result = SDL_PushEvent(&event)) < 0 && running)
+      SDL_Delay(1);
+    if (result == 1)
+      pushed++;
+    else
+      skipped++;
+  }
+
+  trace.Close();
+  running = false;
+  finished = true;
+}
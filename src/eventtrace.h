@@ -0,0 +1,79 @@
+#pragma once
+#include "mappedfile.h"
+#include <SDL2/SDL.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+// Trace file: a header followed by fixed size records in host byte order,
+// so a trace can be replayed straight from a memory mapping.
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+};
+
+struct TraceRecord {
+  uint64_t time;  // microseconds since recording started
+  uint32_t type;  // SDL event type
+  int32_t which;
+  int32_t code;   // axis, button, sensor or touchpad
+  int32_t value;  // axis value, button state, finger or battery level
+  float data[4];  // sensor x, y, z or touchpad x, y, pressure
+};
+static_assert(sizeof(TraceRecord) == 40, "trace records are 40 bytes");
+
+// Controller events that go into a trace. Others are ignored.
+bool TraceRecordFromEvent(const SDL_Event &event, uint64_t time,
+                          TraceRecord *record);
+void TraceRecordToEvent(const TraceRecord &record, SDL_Event *event);
+
+class TraceWriter {
+ public:
+  ~TraceWriter() { Close(); }
+
+  bool Open(const std::string &path);
+  bool IsOpen() const { return file != nullptr; }
+  void Write(const SDL_Event &event);
+  // Returns the number of records written
+  uint64_t Close();
+  const std::string &Error() const { return error; }
+
+ private:
+  FILE *file = nullptr;
+  Uint32 start = 0;
+  uint64_t count = 0;
+  std::string error;
+};
+
+// Pushes the events of a trace into the SDL queue from its own thread, at
+// the recorded pace times speed, or as fast as the queue takes them when
+// speed is 0. Device events are skipped, they would open or close real
+// controllers.
+class TraceReplayer {
+ public:
+  ~TraceReplayer() { Stop(); }
+
+  bool Start(const std::string &path, double speed);
+  void Stop();
+  bool Running() const { return running; }
+  // True once, after a replay ran to the end or was stopped
+  bool TakeFinished() { return finished.exchange(false); }
+  uint64_t Pushed() const { return pushed; }
+  uint64_t Skipped() const { return skipped; }
+  const std::string &Error() const { return error; }
+
+ private:
+  void Replay();
+
+  MappedFile trace;
+  std::thread thread;
+  std::atomic<bool> running{false};
+  std::atomic<bool> finished{false};
+  std::atomic<uint64_t> pushed{0};
+  std::atomic<uint64_t> skipped{0};
+  double speed = 1;
+  std::string error;
+};
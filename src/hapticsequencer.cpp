@@ -0,0 +1,201 @@
+#include "hapticsequencer.h"
+#include <algorithm>
+#include <cmath>
+
+// How often a ramping pattern is sampled
+static const auto RAMP_STEP = std::chrono::milliseconds(4);
+// Longest sleep while patterns play, in case the clock misbehaves
+static const auto IDLE_STEP = std::chrono::milliseconds(250);
+
+void HapticSequencer::Play(int id, SDL_JoystickID which,
+                           SDL_GameController *controller,
+                           std::shared_ptr<const HapticPattern> pattern) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!running) {
+    running = true;
+    thread = std::thread(&HapticSequencer::Run, this);
+  }
+  voices.push_back({id, which, controller, pattern, Clock::now()});
+  wake.notify_one();
+}
+
+bool HapticSequencer::Cancel(int id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  bool found = false;
+  for (auto voice = voices.begin(); voice != voices.end();) {
+    if (id == 0 || voice->id == id) {
+      finished.push_back({voice->id, voice->which, true});
+      voice = voices.erase(voice);
+      found = true;
+    } else {
+      voice++;
+    }
+  }
+  // The thread turns off whatever no longer plays
+  wake.notify_one();
+  return found;
+}
+
+void HapticSequencer::Remove(SDL_JoystickID which) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto voice = voices.begin(); voice != voices.end();) {
+    if (voice->which == which) {
+      finished.push_back({voice->id, voice->which, true});
+      voice = voices.erase(voice);
+    } else {
+      voice++;
+    }
+  }
+  written.erase(which);
+}
+
+void HapticSequencer::TakeFinished(std::vector<HapticDone> *out) {
+  std::lock_guard<std::mutex> lock(mutex);
+  out->insert(out->end(), finished.begin(), finished.end());
+  finished.clear();
+}
+
+void HapticSequencer::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running)
+      return;
+    running = false;
+    wake.notify_one();
+  }
+  thread.join();
+
+  // Do not leave motors running
+  for (auto &entry : written) {
+    Output off;
+    off.controller = entry.second.controller;
+    off.triggers = entry.second.triggers;
+    Write(off, &entry.second);
+  }
+  written.clear();
+  voices.clear();
+}
+
+void HapticSequencer::Run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (running) {
+    if (voices.empty() && written.empty()) {
+      wake.wait(lock);
+      continue;
+    }
+    wake.wait_until(lock, Advance(Clock::now()));
+  }
+}
+
+HapticSequencer::Clock::time_point
+HapticSequencer::Advance(Clock::time_point now) {
+  using Millis = std::chrono::duration<double, std::milli>;
+  Clock::time_point next = now + IDLE_STEP;
+  std::map<SDL_JoystickID, Output> mixed;
+  std::map<SDL_JoystickID, int> priorities;
+
+  for (auto voice = voices.begin(); voice != voices.end();) {
+    const HapticPattern &pattern = *voice->pattern;
+    double elapsed = Millis(now - voice->start).count();
+    double total = static_cast<double>(pattern.length) * pattern.loops;
+    if (pattern.length == 0 || (pattern.loops > 0 && elapsed >= total)) {
+      finished.push_back({voice->id, voice->which, false});
+      voice = voices.erase(voice);
+      continue;
+    }
+
+    // Find the keyframe we are in
+    double position = std::fmod(elapsed, pattern.length);
+    const auto &keyframes = pattern.keyframes;
+    size_t index = 0;
+    double keyStart = 0;
+    while (index + 1 < keyframes.size()
+           && keyStart + keyframes[index].duration <= position) {
+      keyStart += keyframes[index].duration;
+      index++;
+    }
+    const HapticKeyframe &key = keyframes[index];
+    double keyEnd = keyStart + key.duration;
+
+    Output output;
+    output.controller = voice->controller;
+    output.triggers = pattern.triggers;
+    if (pattern.ramp && index + 1 < keyframes.size() && key.duration > 0) {
+      const HapticKeyframe &to = keyframes[index + 1];
+      double t = (position - keyStart) / key.duration;
+      auto lerp = [t](Uint16 a, Uint16 b) {
+        return static_cast<Uint16>(std::lround(a + (b - a) * t));
+      };
+      output.low = lerp(key.low, to.low);
+      output.high = lerp(key.high, to.high);
+      output.left = lerp(key.left, to.left);
+      output.right = lerp(key.right, to.right);
+      next = std::min(next, now + RAMP_STEP);
+    } else {
+      output.low = key.low;
+      output.high = key.high;
+      output.left = key.left;
+      output.right = key.right;
+      next = std::min(next, now + std::chrono::duration_cast<Clock::duration>(
+                                    Millis(keyEnd - position)));
+    }
+
+    // Higher priorities win, equal ones are mixed
+    auto best = priorities.find(voice->which);
+    if (best == priorities.end() || pattern.priority > best->second) {
+      priorities[voice->which] = pattern.priority;
+      mixed[voice->which] = output;
+    } else if (pattern.priority == best->second) {
+      Output &into = mixed[voice->which];
+      into.low = std::max(into.low, output.low);
+      into.high = std::max(into.high, output.high);
+      into.left = std::max(into.left, output.left);
+      into.right = std::max(into.right, output.right);
+      into.triggers = into.triggers || output.triggers;
+    }
+    voice++;
+  }
+
+  // Turn off controllers that have nothing left to play
+  for (auto entry = written.begin(); entry != written.end();) {
+    if (mixed.count(entry->first) == 0) {
+      Output off;
+      off.controller = entry->second.controller;
+      off.triggers = entry->second.triggers;
+      Write(off, &entry->second);
+      entry = written.erase(entry);
+    } else {
+      entry++;
+    }
+  }
+
+  for (auto &entry : mixed) {
+    auto last = written.find(entry.first);
+    if (last == written.end()) {
+      Write(entry.second, nullptr);
+      written[entry.first] = entry.second;
+    } else {
+      entry.second.triggers = entry.second.triggers || last->second.triggers;
+      Write(entry.second, &last->second);
+      last->second = entry.second;
+    }
+  }
+  return next;
+}
+
+void HapticSequencer::Write(const Output &output, const Output *last) {
+  // Duration 0 keeps the motors at this level until the next write
+#if SDL_VERSION_ATLEAST(2, 0, 10)
+  if (!last || last->low != output.low || last->high != output.high)
+    SDL_GameControllerRumble(output.controller, output.low, output.high, 0);
+#else
+  (void) output;
+  (void) last;
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  if (output.triggers
+      && (!last || last->left != output.left || last->right != output.right))
+    SDL_GameControllerRumbleTriggers(output.controller, output.left,
+                                     output.right, 0);
+#endif
+}
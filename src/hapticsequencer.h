@@ -0,0 +1,82 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_gamecontroller.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Motor intensities held for a duration, or ramped towards the next
+// keyframe when the pattern ramps
+struct HapticKeyframe {
+  Uint16 low = 0, high = 0;     // rumble motors
+  Uint16 left = 0, right = 0;   // trigger motors
+  Uint32 duration = 0;          // milliseconds
+};
+
+struct HapticPattern {
+  std::vector<HapticKeyframe> keyframes;
+  Uint32 length = 0;  // sum of the durations
+  int loops = 1;      // 0 repeats until cancelled
+  int priority = 0;
+  bool ramp = false;
+  bool triggers = false;  // any keyframe uses the trigger motors
+};
+
+// A pattern that stopped, reported on the next poll
+struct HapticDone {
+  int id;
+  SDL_JoystickID which;
+  bool cancelled;
+};
+
+// Plays rumble patterns from its own thread, so their timing does not
+// depend on the JS event loop. Positions are worked out from the start
+// time, so late wake ups do not add up. On each controller the patterns
+// with the highest priority play, mixed by taking the strongest value of
+// each motor.
+class HapticSequencer {
+ public:
+  ~HapticSequencer() { Stop(); }
+
+  void Play(int id, SDL_JoystickID which, SDL_GameController *controller,
+            std::shared_ptr<const HapticPattern> pattern);
+  // id 0 cancels everything. Returns false if nothing was playing.
+  bool Cancel(int id);
+  // The controller is gone, forget it without writing to it
+  void Remove(SDL_JoystickID which);
+  void TakeFinished(std::vector<HapticDone> *out);
+  void Stop();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Voice {
+    int id;
+    SDL_JoystickID which;
+    SDL_GameController *controller;
+    std::shared_ptr<const HapticPattern> pattern;
+    Clock::time_point start;
+  };
+
+  struct Output {
+    SDL_GameController *controller = nullptr;
+    Uint16 low = 0, high = 0, left = 0, right = 0;
+    bool triggers = false;
+  };
+
+  void Run();
+  Clock::time_point Advance(Clock::time_point now);
+  static void Write(const Output &output, const Output *last);
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::thread thread;
+  bool running = false;
+  std::vector<Voice> voices;
+  std::map<SDL_JoystickID, Output> written;
+  std::vector<HapticDone> finished;
+};
@@ -0,0 +1,72 @@
+#include "mappedfile.h"
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+bool MappedFile::Open(const std::string &path) {
+  Close();
+
+#ifndef _WIN32
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error = path + ": " + std::strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    error = path + ": " + std::strerror(errno);
+    close(fd);
+    return false;
+  }
+
+  size = static_cast<size_t>(st.st_size);
+  if (size > 0) {
+    void *view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+      error = path + ": " + std::strerror(errno);
+      size = 0;
+      close(fd);
+      return false;
+    }
+    // Mostly read front to back, let the kernel read ahead
+    madvise(view, size, MADV_SEQUENTIAL);
+    data = static_cast<const uint8_t *>(view);
+    mapped = true;
+  }
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+  return true;
+#else
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    error = path + ": can't open file";
+    return false;
+  }
+  contents.assign(std::istreambuf_iterator<char>(file),
+                  std::istreambuf_iterator<char>());
+  data = contents.data();
+  size = contents.size();
+  return true;
+#endif
+}
+
+void MappedFile::Close() {
+#ifndef _WIN32
+  if (mapped)
+    munmap(const_cast<uint8_t *>(data), size);
+#endif
+  mapped = false;
+  contents.clear();
+  data = nullptr;
+  size = 0;
+}
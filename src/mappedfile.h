@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read only view of a whole file. The file is memory mapped so large files
+// are paged in as they are read instead of being loaded up front. Where
+// mmap is not available the file is read into memory.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { Close(); }
+
+  // Returns false and sets Error() if the file can't be opened
+  bool Open(const std::string &path);
+  void Close();
+
+  const uint8_t *Data() const { return data; }
+  size_t Size() const { return size; }
+  const std::string &Error() const { return error; }
+
+ private:
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  bool mapped = false;
+  std::vector<uint8_t> contents;
+  std::string error;
+};
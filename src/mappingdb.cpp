@@ -0,0 +1,86 @@
+#include "mappingdb.h"
+#include <SDL2/SDL_gamecontroller.h>
+#include <cstring>
+#include <string>
+
+static const char PLATFORM_FIELD[] = "platform:";
+
+// Entries without a platform field apply everywhere
+static bool ForThisPlatform(const std::string &entry, const char *platform) {
+  size_t field = entry.find(PLATFORM_FIELD);
+  if (field == std::string::npos)
+    return true;
+  size_t start = field + sizeof(PLATFORM_FIELD) - 1;
+  size_t end = entry.find(',', start);
+  if (end == std::string::npos)
+    end = entry.size();
+  return entry.compare(start, end - start, platform) == 0;
+}
+
+static size_t WithoutTrailingCommas(const char *text, size_t length) {
+  while (length > 0 && text[length - 1] == ',')
+    length--;
+  return length;
+}
+
+static bool Known(const std::string &entry) {
+  std::string guid = entry.substr(0, entry.find(','));
+  SDL_JoystickGUID id = SDL_JoystickGetGUIDFromString(guid.c_str());
+  char *mapping = SDL_GameControllerMappingForGUID(id);
+  if (mapping == nullptr)
+    return false;
+  // SDL may hand it back with or without the trailing comma
+  size_t length = WithoutTrailingCommas(entry.data(), entry.size());
+  bool same = WithoutTrailingCommas(mapping, std::strlen(mapping)) == length
+              && entry.compare(0, length, mapping, length) == 0;
+  SDL_free(mapping);
+  return same;
+}
+
+MappingLoad LoadMappings(const uint8_t *data, size_t size) {
+  MappingLoad load;
+  const char *platform = SDL_GetPlatform();
+  const char *text = reinterpret_cast<const char *>(data);
+  const char *end = text + size;
+  std::string entry;
+
+  while (text < end) {
+    const char *newline =
+      static_cast<const char *>(std::memchr(text, '\n', end - text));
+    const char *lineEnd = newline ? newline : end;
+    const char *line = text;
+    text = newline ? newline + 1 : end;
+
+    // Trim the line, skip blanks and comments
+    while (line < lineEnd && (*line == ' ' || *line == '\t'))
+      line++;
+    while (lineEnd > line
+           && (lineEnd[-1] == '\r' || lineEnd[-1] == ' '
+               || lineEnd[-1] == '\t'))
+      lineEnd--;
+    if (line == lineEnd || *line == '#')
+      continue;
+
+    load.entries++;
+    entry.assign(line, lineEnd);
+    if (!ForThisPlatform(entry, platform)) {
+      load.otherPlatform++;
+      continue;
+    }
+    if (Known(entry)) {
+      load.known++;
+      continue;
+    }
+    switch (SDL_GameControllerAddMapping(entry.c_str())) {
+      case 1:
+        load.added++;
+        break;
+      case 0:
+        load.updated++;
+        break;
+      default:
+        load.failed++;
+    }
+  }
+  return load;
+}
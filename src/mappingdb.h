@@ -0,0 +1,19 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <cstddef>
+#include <cstdint>
+
+// What happened to the entries of one load
+struct MappingLoad {
+  size_t entries = 0;    // mapping lines
+  size_t otherPlatform = 0;
+  size_t known = 0;      // SDL already has exactly this mapping
+  size_t added = 0;
+  size_t updated = 0;    // replaced the mapping of a known GUID
+  size_t failed = 0;
+};
+
+// Applies a gamecontrollerdb.txt style text: one GUID,name,mapping entry
+// per line, # comments. Entries for other platforms and mappings SDL
+// already has are skipped before SDL parses them.
+MappingLoad LoadMappings(const uint8_t *data, size_t size);
@@ -0,0 +1,137 @@
+#include "reflexrules.h"
+#include "eventhub.h"
+
+// Fired rules kept for a controller that is not polled
+static const size_t FIRED_LIMIT = 1024;
+
+int ReflexRules::Add(const ReflexRule &rule) {
+  std::lock_guard<std::mutex> lock(mutex);
+  int id = nextId++;
+  entries.push_back({id, rule, {}});
+  empty = false;
+  return id;
+}
+
+bool ReflexRules::Remove(int id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  bool found = false;
+  for (auto entry = entries.begin(); entry != entries.end();) {
+    if (id == 0 || entry->id == id) {
+      entry = entries.erase(entry);
+      found = true;
+    } else {
+      entry++;
+    }
+  }
+  empty = entries.empty();
+  return found;
+}
+
+void ReflexRules::AddController(SDL_JoystickID which,
+                                SDL_GameController *controller, int player) {
+  std::lock_guard<std::mutex> lock(mutex);
+  targets[which] = {controller, player};
+}
+
+void ReflexRules::RemoveController(SDL_JoystickID which) {
+  std::lock_guard<std::mutex> lock(mutex);
+  targets.erase(which);
+  for (auto &entry : entries)
+    entry.past.erase(which);
+}
+
+void ReflexRules::Inspect(const SDL_Event &event) {
+  // Most instances have no rules, skip the lock for them
+  if (empty)
+    return;
+  bool axis = event.type == SDL_CONTROLLERAXISMOTION;
+  if (!axis && event.type != SDL_CONTROLLERBUTTONDOWN
+      && event.type != SDL_CONTROLLERBUTTONUP)
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &entry : entries) {
+    const ReflexRule &rule = entry.rule;
+    if (rule.axis != axis)
+      continue;
+    if (axis) {
+      if (event.caxis.axis != rule.control)
+        continue;
+      SDL_JoystickID which = event.caxis.which;
+      Sint16 value = event.caxis.value;
+      bool past = rule.rising ? value >= rule.threshold
+                              : value <= rule.threshold;
+      // Only the crossing counts, not every sample past the threshold
+      if (!past) {
+        entry.past.erase(which);
+      } else if (entry.past.insert(which).second) {
+        Fire(&entry, which, value);
+      }
+    } else if (event.cbutton.button == rule.control
+               && (event.type == SDL_CONTROLLERBUTTONDOWN) == rule.pressed) {
+      Fire(&entry, event.cbutton.which, 0);
+    }
+  }
+}
+
+void ReflexRules::Fire(Entry *entry, SDL_JoystickID which, Sint16 value) {
+  const ReflexRule &rule = entry->rule;
+  auto target = targets.find(which);
+  // Pushed events have no controller, they fire without outputs
+  int player = target != targets.end() ? target->second.player : -1;
+  if (rule.player != 0 && rule.player != player)
+    return;
+
+  ReflexFired done = {entry->id, which, player, value, SDL_GetTicks(),
+                      0,         0,     rule};
+  if (target != targets.end()) {
+    SDL_GameController *controller = target->second.controller;
+    if (rule.outputs & REFLEX_RUMBLE) {
+#if SDL_VERSION_ATLEAST(2, 0, 10)
+      bool ok = SDL_GameControllerRumble(controller, rule.low, rule.high,
+                                         rule.rumbleMs)
+                >= 0;
+#else
+      bool ok = false;
+#endif
+      (ok ? done.written : done.failed) |= REFLEX_RUMBLE;
+    }
+    if (rule.outputs & REFLEX_RUMBLE_TRIGGERS) {
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+      bool ok = SDL_GameControllerRumbleTriggers(controller, rule.left,
+                                                 rule.right, rule.triggersMs)
+                >= 0;
+#else
+      bool ok = false;
+#endif
+      (ok ? done.written : done.failed) |= REFLEX_RUMBLE_TRIGGERS;
+    }
+    if (rule.outputs & REFLEX_LED) {
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+      bool ok = SDL_GameControllerSetLED(controller, rule.led[0], rule.led[1],
+                                         rule.led[2])
+                >= 0;
+#else
+      bool ok = false;
+#endif
+      (ok ? done.written : done.failed) |= REFLEX_LED;
+    }
+    (void) controller;
+  }
+  if (fired.size() < FIRED_LIMIT)
+    fired.push_back(done);
+}
+
+void ReflexRules::TakeFired(std::vector<ReflexFired> *out) {
+  std::lock_guard<std::mutex> lock(mutex);
+  out->insert(out->end(), fired.begin(), fired.end());
+  fired.clear();
+}
+
+uint32_t ReflexRules::Classes() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  uint32_t classes = 0;
+  for (auto &entry : entries)
+    classes |= entry.rule.axis ? EVENT_CLASS_AXIS : EVENT_CLASS_BUTTON;
+  return classes;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_gamecontroller.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+// Outputs a rule writes, to the controller whose input set it off
+enum ReflexOutput {
+  REFLEX_RUMBLE = 1 << 0,
+  REFLEX_RUMBLE_TRIGGERS = 1 << 1,
+  REFLEX_LED = 1 << 2
+};
+
+// A button going down or up, or an axis crossing a threshold, answered
+// with outputs
+struct ReflexRule {
+  int player = 0;  // 0 for every player
+  bool axis = false;
+  int control = 0;  // SDL button or axis
+  bool pressed = true;
+  // Axis rules go off when the value reaches the threshold, from below
+  // when rising, from above otherwise
+  Sint16 threshold = 0;
+  bool rising = true;
+
+  uint32_t outputs = 0;
+  Uint16 low = 0, high = 0;
+  Uint32 rumbleMs = 0;
+  Uint16 left = 0, right = 0;
+  Uint32 triggersMs = 0;
+  Uint8 led[3] = {0, 0, 0};
+  bool notify = true;
+};
+
+// A rule that went off, reported on the next poll
+struct ReflexFired {
+  int id;
+  SDL_JoystickID which;
+  int player;
+  Sint16 value;  // of the axis
+  Uint32 ticks;
+  uint32_t written;  // outputs SDL took
+  uint32_t failed;   // outputs SDL refused
+  ReflexRule rule;
+};
+
+// Rules checked on the thread that takes events from SDL, as soon as they
+// are taken, so outputs do not wait for the poll and a JS handler. The
+// controllers are known from their device added events on the JS thread.
+class ReflexRules {
+ public:
+  int Add(const ReflexRule &rule);
+  // id 0 removes every rule. Returns false if there was nothing to remove.
+  bool Remove(int id);
+  void AddController(SDL_JoystickID which, SDL_GameController *controller,
+                     int player);
+  // The controller is about to be closed, stop writing to it
+  void RemoveController(SDL_JoystickID which);
+
+  void Inspect(const SDL_Event &event);
+  void TakeFired(std::vector<ReflexFired> *out);
+  // Event classes the rules look at
+  uint32_t Classes() const;
+
+ private:
+  struct Entry {
+    int id;
+    ReflexRule rule;
+    // Axis rules past their threshold, they go off again once back
+    std::set<SDL_JoystickID> past;
+  };
+  struct Target {
+    SDL_GameController *controller;
+    int player;
+  };
+
+  void Fire(Entry *entry, SDL_JoystickID which, Sint16 value);
+
+  mutable std::mutex mutex;
+  std::vector<Entry> entries;
+  std::unordered_map<SDL_JoystickID, Target> targets;
+  std::vector<ReflexFired> fired;
+  std::atomic<bool> empty{true};
+  int nextId = 1;
+};
@@ -2,11 +2,22 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_events.h>
 #include <SDL2/SDL_gamecontroller.h>
-#include <chrono>
-#include <set>
+#include <algorithm>
 #include <string>
+#include <uv.h>
 
 bool SdlGameController::sdlInit = false;
+bool SdlGameController::sdlHeadless = false;
+bool SdlGameController::sdlEventMask = true;
+SdlInitWorker *SdlGameController::sdlStarting = nullptr;
+std::unordered_map<std::string, int> SdlGameController::eventIds;
+std::vector<Napi::Reference<Napi::String>> SdlGameController::eventNames;
+std::vector<Napi::Reference<Napi::String>> SdlGameController::keys;
+Uint64 SdlGameController::counterFrequency = 0;
+Uint64 SdlGameController::counterAtTick = 0;
+Uint32 SdlGameController::tickAtCounter = 0;
+CapabilityCache SdlGameController::capabilityCache;
+std::set<SdlGameController *> SdlGameController::instances;
 
 Napi::FunctionReference SdlGameController::constructor;
 
@@ -16,11 +27,51 @@ Napi::Object SdlGameController::Init(Napi::Env env, Napi::Object exports) {
   Napi::Function func =
     DefineClass(env, "SdlGameController",
                 {InstanceMethod("pollEvents", &SdlGameController::pollEvents),
+                 InstanceMethod("pollBatch", &SdlGameController::pollBatch),
+                 InstanceMethod("pendingEvents",
+                                &SdlGameController::pendingEvents),
+                 InstanceMethod("pushEvent", &SdlGameController::pushEvent),
+                 InstanceMethod("subscribe", &SdlGameController::subscribe),
+                 InstanceMethod("setFilter", &SdlGameController::setFilter),
+                 InstanceMethod("attachRing", &SdlGameController::attachRing),
+                 InstanceMethod("detachRing", &SdlGameController::detachRing),
+                 InstanceMethod("getState", &SdlGameController::getState),
+                 InstanceMethod("getStats", &SdlGameController::getStats),
+                 InstanceMethod("getOrientation",
+                                &SdlGameController::getOrientation),
+                 InstanceMethod("startRecording",
+                                &SdlGameController::startRecording),
+                 InstanceMethod("stopRecording",
+                                &SdlGameController::stopRecording),
+                 InstanceMethod("replay", &SdlGameController::replay),
+                 InstanceMethod("stopReplay", &SdlGameController::stopReplay),
+                 InstanceMethod("attachVirtual",
+                                &SdlGameController::attachVirtual),
+                 InstanceMethod("setVirtual", &SdlGameController::setVirtual),
+                 InstanceMethod("detachVirtual",
+                                &SdlGameController::detachVirtual),
+                 InstanceMethod("startEventThread",
+                                &SdlGameController::startEventThread),
+                 InstanceMethod("stopEventThread",
+                                &SdlGameController::stopEventThread),
                  InstanceMethod("enableGyroscope",
                                 &SdlGameController::enableGyroscope),
                  InstanceMethod("enableAccelerometer",
                                 &SdlGameController::enableAccelerometer),
                  InstanceMethod("setLeds", &SdlGameController::setLeds),
+                 InstanceMethod("applyOutputs",
+                                &SdlGameController::applyOutputs),
+                 InstanceMethod("playHaptic", &SdlGameController::playHaptic),
+                 InstanceMethod("stopHaptic", &SdlGameController::stopHaptic),
+                 InstanceMethod("setEffects", &SdlGameController::setEffects),
+                 InstanceMethod("init", &SdlGameController::init),
+                 InstanceMethod("loadMappings",
+                                &SdlGameController::loadMappings),
+                 InstanceMethod("addReflex", &SdlGameController::addReflex),
+                 InstanceMethod("removeReflex",
+                                &SdlGameController::removeReflex),
+                 InstanceMethod("addCombo", &SdlGameController::addCombo),
+                 InstanceMethod("removeCombo", &SdlGameController::removeCombo),
                  InstanceMethod("rumble", &SdlGameController::rumble),
                  InstanceMethod("rumbleTriggers",
                                 &SdlGameController::rumbleTriggers)});
@@ -28,61 +79,343 @@ Napi::Object SdlGameController::Init(Napi::Env env, Napi::Object exports) {
   constructor = Napi::Persistent(func);
   constructor.SuppressDestruct();
 
+  InitStrings(env);
+
   exports.Set("SdlGameController", func);
 
   return exports;
 }
 
+// Names of the fixed events, indexed by EventId. Axis and button aliases
+// come from SDL and are filled in by InitStrings.
+static const char *const EVENT_NAMES[] = {
+  "controller-axis-motion",   "controller-button-down",
+  "controller-button-up",     "controller-device-remapped",
+  "controller-touchpad-down", "controller-touchpad-motion",
+  "controller-touchpad-up",   "controller-sensor-update",
+  "gyroscope",                "accelerometer",
+  "controller-battery-update", "sensor-batch",
+  "orientation",              "touchpad-gesture",
+  "touchpad-batch"};
+static_assert(sizeof(EVENT_NAMES) / sizeof(EVENT_NAMES[0]) == EVENT_AXIS_FIRST,
+              "EVENT_NAMES must match EventId");
+
+static const char *const UNMASKED_EVENT_NAMES[] = {
+  "error",           "warning",
+  "sdl-init",        "controller-device-added",
+  "controller-device-removed", "batch",
+  "gyroscope:enabled",         "gyroscope:disabled",
+  "accelerometer:enabled",     "accelerometer:disabled",
+  "led",             "rumbled",
+  "rumbled-triggers",          "replay-done",
+  "controller-capabilities",  "outputs-applied",
+  "haptic-done",     "mappings-loaded",
+  "reflex",          "combo"};
+static_assert(sizeof(UNMASKED_EVENT_NAMES) / sizeof(UNMASKED_EVENT_NAMES[0])
+                == EVENT_ID_COUNT - EVENT_MASKABLE_COUNT,
+              "UNMASKED_EVENT_NAMES must match EventId");
+
+// Indexed by KeyId
+static const char *const KEY_NAMES[] = {
+  "message",
+  "operation",
+  "event",
+  "button",
+  "value",
+  "pressed",
+  "player",
+  "which",
+  "timestamp",
+  "touchpad",
+  "finger",
+  "x",
+  "y",
+  "z",
+  "pressure",
+  "sensor",
+  "level",
+  "Game controller axis motion",
+  "Game controller button pressed",
+  "Game controller button released",
+  "Game controller touchpad was touched",
+  "Game controller touchpad finger was moved",
+  "Game controller touchpad finger was lifted",
+  "Game controller sensor was updated"};
+static_assert(sizeof(KEY_NAMES) / sizeof(KEY_NAMES[0]) == KEY_COUNT,
+              "KEY_NAMES must match KeyId");
+
+static Napi::Reference<Napi::String> Intern(Napi::Env env,
+                                            const std::string &str) {
+  auto ref = Napi::Persistent(Napi::String::New(env, str));
+  ref.SuppressDestruct();
+  return ref;
+}
+
+void SdlGameController::InitStrings(Napi::Env env) {
+  std::vector<std::string> names(EVENT_ID_COUNT);
+  for (int id = 0; id < EVENT_AXIS_FIRST; id++) {
+    names[id] = EVENT_NAMES[id];
+  }
+
+  for (int axis = 0; axis < SDL_CONTROLLER_AXIS_MAX; axis++) {
+    auto name = SDL_GameControllerGetStringForAxis(
+      static_cast<SDL_GameControllerAxis>(axis));
+    if (name)
+      names[EVENT_AXIS_FIRST + axis] = name;
+  }
+
+  for (int button = 0; button < SDL_CONTROLLER_BUTTON_MAX; button++) {
+    auto name = SDL_GameControllerGetStringForButton(
+      static_cast<SDL_GameControllerButton>(button));
+    if (name) {
+      std::string gcBtn = name;
+      names[ButtonEventId(button)] = gcBtn;
+      names[ButtonEventId(button, BUTTON_ALIAS_DOWN)] = gcBtn + ":down";
+      names[ButtonEventId(button, BUTTON_ALIAS_UP)] = gcBtn + ":up";
+    }
+  }
+
+  for (int id = EVENT_MASKABLE_COUNT; id < EVENT_ID_COUNT; id++) {
+    names[id] = UNMASKED_EVENT_NAMES[id - EVENT_MASKABLE_COUNT];
+  }
+
+  for (int id = 0; id < EVENT_ID_COUNT; id++) {
+    if (!names[id].empty() && id < EVENT_MASKABLE_COUNT)
+      eventIds[names[id]] = id;
+    eventNames.push_back(Intern(env, names[id]));
+  }
+
+  for (int id = 0; id < KEY_COUNT; id++) {
+    keys.push_back(Intern(env, KEY_NAMES[id]));
+  }
+}
+
+Napi::String SdlGameController::EventName(int id) {
+  return eventNames[id].Value();
+}
+
+Napi::String SdlGameController::Key(KeyId id) { return keys[id].Value(); }
+
+Napi::Function SdlGameController::Emitter(const Napi::CallbackInfo &info) {
+  // Bind emit once per instance instead of on every call
+  if (emitRef.IsEmpty()) {
+    Napi::Function emit_unbound =
+      info.This().As<Napi::Object>().Get("emit").As<Napi::Function>();
+    Napi::Function emit = emit_unbound.Get("bind")
+                            .As<Napi::Function>()
+                            .Call(emit_unbound, {info.This()})
+                            .As<Napi::Function>();
+    emitRef = Napi::Persistent(emit);
+  }
+  return emitRef.Value();
+}
+
+// capabilities.txt in SDL's preference directory, empty when there is none
+static std::string DefaultCachePath() {
+  std::string path;
+  char *pref = SDL_GetPrefPath("", "sdl2-gamecontroller");
+  if (pref) {
+    path = std::string(pref) + "capabilities.txt";
+    SDL_free(pref);
+  }
+  return path;
+}
+
 SdlGameController::SdlGameController(const Napi::CallbackInfo &info)
-    : Napi::ObjectWrap<SdlGameController>(info), poll_number(0) {
+    : Napi::ObjectWrap<SdlGameController>(info),
+      poll_number(0),
+      pollStart(0),
+      pollEventCount(0),
+      pollBudgetMicros(100000),
+      pollMaxEvents(0),
+      pollCheckEvery(64),
+      pollPending(0),
+      queueLostSeen(0),
+      batchMode(false),
+      listenerAware(false),
+      axisCoalesce(false),
+      axisFilter(false),
+      sensorStream(false),
+      sensorRate(0),
+      sensorFusion(false),
+      fusionBeta(0.1f),
+      orientationRate(30),
+      lastOrientationTicks(0),
+      touchpadGestures(false),
+      touchpadRaw(false),
+      capabilityCacheConflict(false),
+      outputInterval(8),
+      nextHapticId(1),
+      ringData(nullptr),
+      ringCapacity(0),
+      batchIndex(0),
+      eventThreadRunning(false) {
+  SDL_zero(axisDeadzone);
+  SDL_zero(axisThreshold);
   if (info.Length() > 0) {
     Napi::Object config = info[0].As<Napi::Object>();
     Napi::Value value = config.Get("sdl_joystick_rog_chakram");
     auto sdl_joystick_rog_chakram = value.ToBoolean();
     if (sdl_joystick_rog_chakram)
       this->hints.insert("sdl_joystick_rog_chakram");
+
+    batchMode = config.Get("batch").ToBoolean();
+
+    Napi::Value budget = config.Get("poll_budget_us");
+    if (budget.IsNumber() && budget.As<Napi::Number>().DoubleValue() >= 0)
+      pollBudgetMicros = budget.As<Napi::Number>().Int64Value();
+    Napi::Value maxEvents = config.Get("poll_max_events");
+    if (maxEvents.IsNumber() && maxEvents.As<Napi::Number>().DoubleValue() >= 0)
+      pollMaxEvents = maxEvents.As<Napi::Number>().Int64Value();
+    Napi::Value checkEvery = config.Get("poll_check_every");
+    if (checkEvery.IsNumber() && checkEvery.As<Napi::Number>().Int32Value() > 0)
+      pollCheckEvery = checkEvery.As<Napi::Number>().Uint32Value();
+    listenerAware = config.Get("listener_aware").ToBoolean();
+
+    axisCoalesce = config.Get("axis_coalesce").ToBoolean();
+    ReadAxisOption(config, "axis_deadzone", axisDeadzone);
+    ReadAxisOption(config, "axis_threshold", axisThreshold);
+
+    sensorStream = config.Get("sensor_stream").ToBoolean();
+    Napi::Value rate = config.Get("sensor_rate");
+    if (rate.IsNumber())
+      sensorRate = rate.As<Napi::Number>().DoubleValue();
+
+    sensorFusion = config.Get("sensor_fusion").ToBoolean();
+    Napi::Value beta = config.Get("fusion_beta");
+    if (beta.IsNumber())
+      fusionBeta = beta.As<Napi::Number>().FloatValue();
+    Napi::Value orientation = config.Get("orientation_rate");
+    if (orientation.IsNumber())
+      orientationRate = orientation.As<Napi::Number>().DoubleValue();
+
+    touchpadGestures = config.Get("touchpad_gestures").ToBoolean();
+    touchpadRaw = config.Get("touchpad_raw").ToBoolean();
+
+    Napi::Value headless = config.Get("headless");
+    if (headless.IsBoolean() && !sdlInit && sdlStarting == nullptr)
+      sdlHeadless = headless.ToBoolean();
+    Napi::Value eventMask = config.Get("event_mask");
+    if (eventMask.IsBoolean() && !sdlInit && sdlStarting == nullptr)
+      sdlEventMask = eventMask.ToBoolean();
+
+    hubConsumer.filter = ReadFilter(config.Get("filter"));
+
+    // The cache is shared by the process, the first path given is used
+    Napi::Value cache = config.Get("capability_cache");
+    if (cache.IsString() || cache.IsBoolean()) {
+      std::string path;
+      if (cache.IsString())
+        path = cache.As<Napi::String>().Utf8Value();
+      else if (cache.ToBoolean())
+        path = DefaultCachePath();
+      capabilityCacheConflict = !capabilityCache.Open(path);
+    }
+
+    Napi::Value outputRate = config.Get("output_rate");
+    if (outputRate.IsNumber()) {
+      double hz = outputRate.As<Napi::Number>().DoubleValue();
+      outputInterval = hz > 0 ? static_cast<Uint32>(1000 / hz) : 0;
+    }
+  }
+
+  for (int axis = 0; axis < SDL_CONTROLLER_AXIS_MAX; axis++) {
+    if (axisDeadzone[axis] > 0 || axisThreshold[axis] > 0)
+      axisFilter = true;
+  }
+
+  hubConsumer.wanted = WantedClasses();
+  hubConsumer.inspect = [this](const SDL_Event &event) {
+    reflexes.Inspect(event);
+  };
+  EventHub::Instance().Register(&hubConsumer);
+  instances.insert(this);
+  queueLostSeen = EventHub::Instance().Lost();
+}
+
+void SdlGameController::ReadAxisOption(Napi::Object config, const char *name,
+                                       Sint16 *values) {
+  // Either one number for every axis or an object keyed by SDL axis name
+  Napi::Value option = config.Get(name);
+  for (int axis = 0; axis < SDL_CONTROLLER_AXIS_MAX; axis++) {
+    Napi::Value value = option;
+    if (option.IsObject()) {
+      auto axisName =
+        SDL_GameControllerGetStringForAxis((SDL_GameControllerAxis) axis);
+      value = option.As<Napi::Object>().Get(axisName);
+    }
+
+    double number = 0;
+    if (value.IsNumber())
+      number = value.As<Napi::Number>().DoubleValue();
+    if (number < 0)
+      number = 0;
+    if (number > SDL_JOYSTICK_AXIS_MAX)
+      number = SDL_JOYSTICK_AXIS_MAX;
+    values[axis] = (Sint16) number;
   }
 }
 
-/* PS5 trigger effect documentation:
-   https://controllers.fandom.com/wiki/Sony_DualSense#FFB_Trigger_Modes
-*/
-typedef struct {
-  Uint8 ucEnableBits1;              /* 0 */
-  Uint8 ucEnableBits2;              /* 1 */
-  Uint8 ucRumbleRight;              /* 2 */
-  Uint8 ucRumbleLeft;               /* 3 */
-  Uint8 ucHeadphoneVolume;          /* 4 */
-  Uint8 ucSpeakerVolume;            /* 5 */
-  Uint8 ucMicrophoneVolume;         /* 6 */
-  Uint8 ucAudioEnableBits;          /* 7 */
-  Uint8 ucMicLightMode;             /* 8 */
-  Uint8 ucAudioMuteBits;            /* 9 */
-  Uint8 rgucRightTriggerEffect[11]; /* 10 */
-  Uint8 rgucLeftTriggerEffect[11];  /* 21 */
-  Uint8 rgucUnknown1[6];            /* 32 */
-  Uint8 ucLedFlags;                 /* 38 */
-  Uint8 rgucUnknown2[2];            /* 39 */
-  Uint8 ucLedAnim;                  /* 41 */
-  Uint8 ucLedBrightness;            /* 42 */
-  Uint8 ucPadLights;                /* 43 */
-  Uint8 ucLedRed;                   /* 44 */
-  Uint8 ucLedGreen;                 /* 45 */
-  Uint8 ucLedBlue;                  /* 46 */
-} DS5EffectsState_t;
+HubFilter SdlGameController::ReadFilter(Napi::Value value) {
+  static const struct {
+    const char *name;
+    uint32_t eventClass;
+  } CLASS_NAMES[] = {{"axis", EVENT_CLASS_AXIS},
+                     {"button", EVENT_CLASS_BUTTON},
+                     {"touchpad", EVENT_CLASS_TOUCHPAD},
+                     {"sensor", EVENT_CLASS_SENSOR},
+                     {"battery", EVENT_CLASS_BATTERY}};
+
+  HubFilter filter;
+  if (!value.IsObject())
+    return filter;
+  Napi::Object options = value.As<Napi::Object>();
+
+  Napi::Value players = options.Get("players");
+  if (players.IsArray()) {
+    Napi::Array list = players.As<Napi::Array>();
+    for (uint32_t i = 0; i < list.Length(); i++)
+      filter.players.insert(list.Get(i).ToNumber().Int32Value());
+  }
+
+  Napi::Value devices = options.Get("devices");
+  if (devices.IsArray()) {
+    Napi::Array list = devices.As<Napi::Array>();
+    for (uint32_t i = 0; i < list.Length(); i++)
+      filter.devices.insert(list.Get(i).ToNumber().Int32Value());
+  }
+
+  Napi::Value classes = options.Get("classes");
+  if (classes.IsArray()) {
+    Napi::Array list = classes.As<Napi::Array>();
+    filter.classes = 0;
+    for (uint32_t i = 0; i < list.Length(); i++) {
+      auto name = list.Get(i).ToString().Utf8Value();
+      for (auto &entry : CLASS_NAMES) {
+        if (name == entry.name)
+          filter.classes |= entry.eventClass;
+      }
+    }
+  }
+  return filter;
+}
+
+SdlGameController::~SdlGameController() {
+  instances.erase(this);
+  StopEventThread();
+  EventHub::Instance().Unregister(&hubConsumer);
+}
 
 bool SdlGameController::SendEffect(SDL_GameController *gamecontroller) {
 #if SDL_VERSION_ATLEAST(2, 0, 14)
   if (SDL_GameControllerGetType(gamecontroller) != SDL_CONTROLLER_TYPE_PS5)
     return SDL_FALSE;
 
-  Uint8 clear[11] = {0x05, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  Ds5Effects effects;
+  effects.SetTrigger(DS5_RIGHT_TRIGGER, Ds5Trigger());
+  effects.SetTrigger(DS5_LEFT_TRIGGER, Ds5Trigger());
   DS5EffectsState_t state;
-  SDL_zero(state);
-  state.ucEnableBits1 |=
-    (0x04 | 0x08); /* Modify right and left trigger effect respectively */
-  SDL_memcpy(state.rgucRightTriggerEffect, clear, sizeof(clear));
-  SDL_memcpy(state.rgucLeftTriggerEffect, clear, sizeof(clear));
+  effects.Report(&state);
   auto success =
     SDL_GameControllerSendEffect(gamecontroller, &state, sizeof(state)) == 0;
   return success;
@@ -92,6 +425,61 @@ bool SdlGameController::SendEffect(SDL_GameController *gamecontroller) {
 #endif
 }
 
+static CapabilityKey CapabilityKeyFor(SDL_GameController *controller) {
+  CapabilityKey key;
+  key.vendor = SDL_GameControllerGetVendor(controller);
+  key.product = SDL_GameControllerGetProduct(controller);
+  key.version = SDL_GameControllerGetProductVersion(controller);
+#if SDL_VERSION_ATLEAST(2, 24, 0)
+  key.firmware = SDL_GameControllerGetFirmwareVersion(controller);
+#endif
+  return key;
+}
+
+// Probes one controller model on the libuv thread pool, once for the
+// whole process. It holds its own handle on the controller, so an unplug
+// during the probe cannot free it, and the result goes to every instance.
+class CapabilityProbe : public Napi::AsyncWorker {
+ public:
+  CapabilityProbe(Napi::Env env, int device_index, const CapabilityKey &key)
+      : Napi::AsyncWorker(env),
+        controller(SDL_GameControllerOpen(device_index)),
+        key(key),
+        caps(0),
+        probed(false) {}
+
+  ~CapabilityProbe() override {
+    if (controller)
+      SDL_GameControllerClose(controller);
+  }
+
+  void Execute() override {
+    if (controller)
+      caps = SdlGameController::ProbeCapabilities(controller);
+    // A controller unplugged while it was tried says nothing about its model
+    probed = controller && SDL_GameControllerGetAttached(controller);
+    if (probed)
+      SdlGameController::capabilityCache.Store(key, caps);
+    else
+      SdlGameController::capabilityCache.Release(key);
+  }
+
+  void OnOK() override {
+    for (auto instance : SdlGameController::instances)
+      instance->ProbeDone(Env(), key, caps, probed);
+  }
+
+ private:
+  SDL_GameController *controller;
+  CapabilityKey key;
+  uint32_t caps;
+  bool probed;
+};
+
+static bool SameModel(const CapabilityKey &a, const CapabilityKey &b) {
+  return !(a < b) && !(b < a);
+}
+
 SDL_GameController *SdlGameController::AddController(const int device_index,
                                                      Napi::Object *obj) {
   SDL_JoystickID controller_id = SDL_JoystickGetDeviceInstanceID(device_index);
@@ -100,18 +488,17 @@ SDL_GameController *SdlGameController::AddController(const int device_index,
     return nullptr;
   }
 
-  auto controller = SdlGameController::gamecontrollers[controller_id];
-  if (controller) {
+  auto known = controllers.Find(controller_id);
+  if (known) {
     // We already have this controller
-    return controller;
+    return known->controller;
   }
 
   // remember this controller
-  controller = SDL_GameControllerOpen(device_index);
-  if (controller)
-    gamecontrollers[controller_id] = controller;
-  else
+  auto controller = SDL_GameControllerOpen(device_index);
+  if (!controller)
     return nullptr;
+  auto record = controllers.Add(controller_id, controller);
 
   obj->Set("message",
            "A new Game controller has been inserted into the system");
@@ -125,6 +512,14 @@ SDL_GameController *SdlGameController::AddController(const int device_index,
 #if SDL_VERSION_ATLEAST(2, 0, 18)
   auto trigger = SDL_GameControllerHasRumbleTriggers(controller) ? true : false;
   obj->Set("has_rumble_trigger", trigger);
+  if (trigger)
+    record->caps |= CAP_RUMBLE_TRIGGERS;
+  if (SDL_GameControllerHasRumble(controller))
+    record->caps |= CAP_RUMBLE;
+  record->known |= CAP_RUMBLE | CAP_RUMBLE_TRIGGERS;
+#elif SDL_VERSION_ATLEAST(2, 0, 14)
+  // No way to ask, let SDL report it when rumbleTriggers is called
+  record->caps |= CAP_RUMBLE_TRIGGERS;
 #endif
 
 #if SDL_VERSION_ATLEAST(2, 0, 14)
@@ -139,6 +534,7 @@ SDL_GameController *SdlGameController::AddController(const int device_index,
 
   auto nTouchPads = SDL_GameControllerGetNumTouchpads(controller);
   obj->Set("num_touchpads", nTouchPads);
+  record->touchpads = nTouchPads;
 
   auto accelerometer =
     SDL_GameControllerHasSensor(controller, SDL_SENSOR_ACCEL) ? true : false;
@@ -147,389 +543,1896 @@ SDL_GameController *SdlGameController::AddController(const int device_index,
   auto gyroscope =
     SDL_GameControllerHasSensor(controller, SDL_SENSOR_GYRO) ? true : false;
   obj->Set("has_gyroscope", gyroscope);
+
+  if (hasLeds)
+    record->caps |= CAP_LED;
+  if (accelerometer)
+    record->caps |= CAP_ACCELEROMETER;
+  if (gyroscope)
+    record->caps |= CAP_GYROSCOPE;
+  record->known |= CAP_LED | CAP_ACCELEROMETER | CAP_GYROSCOPE;
 #endif
 
 #if SDL_VERSION_ATLEAST(2, 0, 12)
   auto player = NextPlayer();
   SDL_GameControllerSetPlayerIndex(controller, player);
   obj->Set("player", player);
+  record->player = player;
 #endif
-
-  auto effects = SendEffect(controller) ? true : false;
-  obj->Set("effects_supported", effects);
+  reflexes.AddController(controller_id, controller, record->player);
 
   auto js = SDL_GameControllerGetJoystick(controller);
   auto isHaptic = SDL_JoystickIsHaptic(js) ? true : false;
   obj->Set("haptic", isHaptic);
+  if (isHaptic)
+    record->caps |= CAP_HAPTIC;
+
+  // Only a DualSense takes effect reports, any other type is known to lack
+  // them without probing
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  if (SDL_GameControllerGetType(controller) != SDL_CONTROLLER_TYPE_PS5)
+    record->known |= CAP_EFFECTS;
+#else
+  record->known |= CAP_EFFECTS;
+#endif
+
+  // Resets the triggers and lights of a DualSense, and tells whether it
+  // takes effect reports. It is one short report, so it is sent on every
+  // connect.
+  if (SendEffect(controller))
+    record->caps |= CAP_EFFECTS;
+
+  // Rumble can only be found out by trying it, which writes to the device
+  // for 250 ms. Known models come from the cache, others are probed on a
+  // worker thread and reported with controller-capabilities.
+  if (capabilityCacheConflict && !emitRef.IsEmpty()) {
+    capabilityCacheConflict = false;
+    auto warning = Napi::Object::New(obj->Env());
+    warning.Set(Key(KEY_MESSAGE), "capability_cache is process wide, the one "
+                                  "given first is used");
+    warning.Set(Key(KEY_OPERATION), "capability_cache");
+    Napi::Function emit = emitRef.Value();
+    emit({EventName(EVENT_WARNING), warning});
+  }
 
+  CapabilityKey key = CapabilityKeyFor(controller);
+  uint32_t probed = 0;
+  if (capabilityCache.Lookup(key, &probed)) {
+    record->caps |= probed;
+  } else {
+    // Another instance may be probing the model already
+    record->probing = true;
+    if (capabilityCache.Claim(key))
+      (new CapabilityProbe(obj->Env(), device_index, key))->Queue();
+  }
+
+  obj->Set("effects_supported", record->Has(CAP_EFFECTS));
+#if SDL_VERSION_ATLEAST(2, 0, 10)
+  obj->Set("has_rumble", record->Has(CAP_RUMBLE));
+#endif
+  if (record->probing)
+    obj->Set("probing", true);
+
+  return controller;
+}
+
+uint32_t SdlGameController::ProbeCapabilities(SDL_GameController *controller) {
+  uint32_t caps = 0;
   SDL_ClearError();
   // Range seems to be 0x0200 - 0xFFFC
 #if SDL_VERSION_ATLEAST(2, 0, 10)
-  auto rumble = SDL_GameControllerRumble(controller, 0x0200, 0x0200, 250) >= 0;
-  obj->Set("has_rumble", rumble);
+  if (SDL_GameControllerRumble(controller, 0x0200, 0x0200, 250) >= 0)
+    caps |= CAP_RUMBLE;
 #endif
+  return caps;
+}
 
-  return controller;
+void SdlGameController::ProbeDone(Napi::Env env, const CapabilityKey &key,
+                                  uint32_t caps, bool probed) {
+  for (auto &record : controllers) {
+    if (!record.probing || !SameModel(key, CapabilityKeyFor(record.controller)))
+      continue;
+    record.probing = false;
+    // Without a result the outputs are still tried, SDL reports the outcome
+    if (!probed)
+      continue;
+    record.caps |= caps;
+    if (emitRef.IsEmpty())
+      continue;
+
+    auto obj = Napi::Object::New(env);
+    obj.Set(Key(KEY_MESSAGE), "Game controller capabilities were probed");
+    obj.Set(Key(KEY_WHICH), static_cast<int>(record.which));
+    obj.Set(Key(KEY_PLAYER), record.player);
+    obj.Set("effects_supported", record.Has(CAP_EFFECTS));
+    obj.Set("has_rumble", record.Has(CAP_RUMBLE));
+    Napi::Function emit = emitRef.Value();
+    emit({EventName(EVENT_CONTROLLER_CAPABILITIES), obj});
+  }
 }
 
 void SdlGameController::RemoveController(const SDL_JoystickID which) {
-  auto search = gamecontrollers.find(which);
-  if (search != gamecontrollers.end()) {
-    gamecontrollers.erase(search);
+  haptics.Remove(which);
+  reflexes.RemoveController(which);
+  combos.RemoveController(which);
+  controllers.Remove(which);
+  lastAxis.erase(which);
+
+  for (auto stream = sensorStreams.begin(); stream != sensorStreams.end();) {
+    if (stream->which == which)
+      stream = sensorStreams.erase(stream);
+    else
+      stream++;
   }
+  fusion.erase(which);
+  touchGestures.erase(which);
 }
 
 int SdlGameController::NextPlayer() {
 #if SDL_VERSION_ATLEAST(2, 0, 12)
-  // find current players
-  std::set<int> players;
-  for (auto &controller : gamecontrollers) {
-    auto player = SDL_GameControllerGetPlayerIndex(controller.second);
-    players.insert(player);
+  // The controller being added already has a record, with no player yet
+  return controllers.FreePlayer();
+#else
+  return -1;
+#endif
+}
+
+// Hints and SDL_Init, safe to run off the JS thread
+bool SdlGameController::StartSdl(const std::set<std::string> &hints) {
+  SDL_SetHint(SDL_HINT_ACCELEROMETER_AS_JOYSTICK, "0");
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+  SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_JOY_CONS, "1");
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 10)
+  SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_PS4_RUMBLE, "1");
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+  SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_PS5_RUMBLE, "1");
+#endif
+  SDL_SetHint(SDL_HINT_JOYSTICK_ALLOW_BACKGROUND_EVENTS, "1");
+#if SDL_VERSION_ATLEAST(2, 0, 22)
+  if (hints.count("sdl_joystick_rog_chakram") > 0) {
+    SDL_SetHint(SDL_HINT_JOYSTICK_ROG_CHAKRAM, "1");
   }
+#else
+  (void) hints;
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 24)
+  SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_SHIELD, "1");
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 26)
+  SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX_360, "1");
+  SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX_360_PLAYER_LED, "1");
+  SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX_360_WIRELESS, "1");
+  SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX_ONE, "1");
+  SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX_ONE_HOME_LED, "1");
+  SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_WII_PLAYER_LED, "1");
+#endif
+
+  // The video subsystem is only needed for the keyboard
+  Uint32 flags = SDL_INIT_JOYSTICK | SDL_INIT_GAMECONTROLLER;
+  if (!sdlHeadless)
+    flags |= SDL_INIT_VIDEO;
+  return SDL_Init(flags) >= 0;
+}
 
-  // Find the first available player slot. Max number of players is 8 probably.
-  for (int player = 1; player < 8; player++) {
-    auto search = players.find(player);
-    if (search == players.end()) {
-      return player;
+// Reports the start and adds the controllers that are already connected.
+// With init() they were opened on the worker, so init_ms includes that.
+Napi::Object
+SdlGameController::SdlStarted(Napi::Env env, Napi::Function emit,
+                              std::chrono::steady_clock::time_point begin,
+                              bool async) {
+  SDL_version compiled;
+  SDL_version linked;
+
+  SDL_VERSION(&compiled);
+  SDL_GetVersion(&linked);
+
+  auto info = Napi::Object::New(env);
+  std::string compile_info = std::to_string(compiled.major) + "."
+                             + std::to_string(compiled.minor) + "."
+                             + std::to_string(compiled.patch);
+  info.Set("compiled_against_SDL_version", compile_info);
+  std::string link_info = std::to_string(linked.major) + "."
+                          + std::to_string(linked.minor) + "."
+                          + std::to_string(linked.patch);
+  info.Set("linked_against_SDL_version", link_info);
+#if SDL_VERSION_ATLEAST(2, 0, 22)
+  if (this->hints.count("sdl_joystick_rog_chakram") > 0) {
+    info.Set("using_hints", "sdl_joystick_rog_chakram");
+  }
+#endif
+  using Millis = std::chrono::duration<double, std::milli>;
+  info.Set("init_ms",
+           Millis(std::chrono::steady_clock::now() - begin).count());
+  size_t rss = 0;
+  if (uv_resident_set_memory(&rss) == 0)
+    info.Set("rss_bytes", static_cast<double>(rss));
+  info.Set("headless", sdlHeadless);
+  info.Set("async", async);
+  emit({EventName(EVENT_SDL_INIT), info});
+  SdlGameController::sdlInit = true;
+  // Kept when a controller was created with capability_cache already
+  capabilityCache.Open(DefaultCachePath());
+  // Keyboard events need the video subsystem, and are only for testing
+  EventHub::Instance().Attach(!sdlHeadless, sdlEventMask);
+
+  for (auto i = 0; i < SDL_NumJoysticks(); ++i) {
+    if (SDL_IsGameController(i)) {
+      auto obj = Napi::Object::New(env);
+      auto gc = AddController(i, &obj);
+      if (gc) {
+        obj.Set("operation", "SDL_Init");
+        emit({EventName(EVENT_CONTROLLER_DEVICE_ADDED), obj});
+      } else {
+        obj.Set("message", SDL_GetError());
+        obj.Set("operation", "SDL_GameControllerOpen");
+        emit({EventName(EVENT_ERROR), obj});
+      }
+    }
+  }
+  return info;
+}
+
+bool SdlGameController::InitSdl(Napi::Env env, Napi::Function emit,
+                                Napi::Object *started) {
+  if (SdlGameController::sdlInit)
+    return true;
+  // Not ready until the running init() finishes
+  if (sdlStarting != nullptr)
+    return false;
+
+  auto begin = std::chrono::steady_clock::now();
+  if (!StartSdl(hints)) {
+    emit({EventName(EVENT_ERROR), Napi::String::New(env, SDL_GetError())});
+    return false;
+  }
+  auto info = SdlStarted(env, emit, begin, false);
+  if (started)
+    *started = info;
+  return true;
+}
+
+// Starts SDL and opens the connected controllers on a worker thread. The
+// controllers are opened again on the JS thread, which SDL answers from
+// the handles opened here, and those are closed afterwards. The worker's
+// receiver is the instance that called init, which keeps it from being
+// collected before OnOK uses it.
+class SdlInitWorker : public Napi::AsyncWorker {
+ public:
+  SdlInitWorker(Napi::Object receiver, Napi::Function emit,
+                SdlGameController *owner)
+      : Napi::AsyncWorker(receiver, emit),
+        owner(owner),
+        hints(owner->hints),
+        begin(std::chrono::steady_clock::now()),
+        started(false) {}
+
+  void Wait(Napi::Promise::Deferred deferred) { waiting.push_back(deferred); }
+
+  void Execute() override {
+    started = SdlGameController::StartSdl(hints);
+    if (!started) {
+      // SDL errors are per thread
+      error = SDL_GetError();
+      return;
+    }
+    for (auto i = 0; i < SDL_NumJoysticks(); ++i) {
+      if (!SDL_IsGameController(i))
+        continue;
+      SDL_GameController *controller = SDL_GameControllerOpen(i);
+      if (controller)
+        opened.push_back(controller);
     }
   }
+
+  void OnOK() override {
+    Napi::Env env = Env();
+    Napi::Function emit = Callback().Value();
+    SdlGameController::sdlStarting = nullptr;
+    if (!started) {
+      emit({SdlGameController::EventName(EVENT_ERROR),
+            Napi::String::New(env, error)});
+      auto reason = Napi::Error::New(env, error);
+      for (auto &deferred : waiting)
+        deferred.Reject(reason.Value());
+      return;
+    }
+
+    auto info = owner->SdlStarted(env, emit, begin, true);
+    for (auto controller : opened)
+      SDL_GameControllerClose(controller);
+    for (auto &deferred : waiting)
+      deferred.Resolve(info);
+  }
+
+ private:
+  SdlGameController *owner;
+  std::set<std::string> hints;
+  std::chrono::steady_clock::time_point begin;
+  bool started;
+  std::string error;
+  std::vector<SDL_GameController *> opened;
+  std::vector<Napi::Promise::Deferred> waiting;
+};
+
+Napi::Value SdlGameController::init(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  auto deferred = Napi::Promise::Deferred::New(env);
+
+  if (info.Length() > 0 && info[0].IsObject()) {
+    Napi::Value headless = info[0].As<Napi::Object>().Get("headless");
+    if (headless.IsBoolean() && !sdlInit && sdlStarting == nullptr)
+      sdlHeadless = headless.ToBoolean();
+  }
+
+  bool onThisThread = false;
+#ifdef __APPLE__
+  // Cocoa has to be started from the main thread
+  onThisThread = !sdlHeadless;
 #endif
-  return -1;
+
+  if (sdlInit) {
+    // Started already, possibly by a poll
+    auto obj = Napi::Object::New(env);
+    obj.Set(Key(KEY_MESSAGE), "SDL was already initialized");
+    obj.Set("headless", sdlHeadless);
+    deferred.Resolve(obj);
+  } else if (sdlStarting != nullptr) {
+    sdlStarting->Wait(deferred);
+  } else if (onThisThread) {
+    auto started = Napi::Object::New(env);
+    if (InitSdl(env, Emitter(info), &started))
+      deferred.Resolve(started);
+    else
+      deferred.Reject(Napi::Error::New(env, SDL_GetError()).Value());
+  } else {
+    sdlStarting =
+        new SdlInitWorker(info.This().As<Napi::Object>(), Emitter(info), this);
+    sdlStarting->Wait(deferred);
+    sdlStarting->Queue();
+  }
+  return deferred.Promise();
+}
+
+Napi::Value SdlGameController::pollEvents(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+
+  EventSink sink;
+  sink.emit = emit;
+  int pending = DrainSdlQueue(env, &sink);
+
+  return Napi::Number::New(env, pending);
+}
+
+Napi::Value SdlGameController::pendingEvents(const Napi::CallbackInfo &info) {
+  return Napi::Number::New(info.Env(), pollPending);
+}
+
+Napi::Value SdlGameController::pollBatch(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+
+  EventSink sink;
+  sink.emit = emit;
+  sink.batching = true;
+  sink.batch = Napi::Array::New(env);
+  DrainSdlQueue(env, &sink);
+
+  return sink.batch;
+}
+
+int SdlGameController::DrainSdlQueue(Napi::Env env, EventSink *sink) {
+  BeginPoll();
+
+  // Set up SDL, nothing to poll while init() is still starting it
+  if (!InitSdl(env, sink->emit)) {
+    pollPending = 0;
+    return 0;
+  }
+
+  // The first poll picks up everything connected at startup, let it finish
+  Uint64 budget = pollBudgetMicros * counterFrequency / 1000000;
+  if (poll_number <= 1)
+    budget = 0;
+
+  // Events are pumped from SDL through the hub a few at a time, so every
+  // instance sees them and none takes them from another. Limits are checked
+  // before the next event; what is left waits in eventBatch or the inbox.
+  EventHub &hub = EventHub::Instance();
+  uint64_t handled = 0;
+  bool stopped = false;
+  for (;;) {
+    if (batchIndex == eventBatch.size()) {
+      eventBatch.clear();
+      batchIndex = 0;
+      hub.Take(&hubConsumer, &eventBatch);
+      if (eventBatch.empty()) {
+        if (hub.Pump(pollCheckEvery) == 0)
+          break;
+        continue;
+      }
+    }
+
+    if (pollMaxEvents > 0 && handled >= pollMaxEvents) {
+      stopped = true;
+      break;
+    }
+    // Reading the clock costs more than handling an event, do it now and then
+    if (budget > 0 && handled > 0 && handled % pollCheckEvery == 0) {
+      Uint64 elapsed = SDL_GetPerformanceCounter() - pollStart;
+      if (elapsed > budget) {
+        auto obj = Napi::Object::New(env);
+        obj.Set("message", "Polling is taking too long.");
+        obj.Set("elapsed_ms", elapsed * 1000 / counterFrequency);
+        obj.Set("poll_number", poll_number);
+        obj.Set("events", handled);
+        Emit(sink, EVENT_WARNING, obj);
+        stats.pollOverruns++;
+        stopped = true;
+        break;
+      }
+    }
+
+    DeliverEvent(env, sink, eventBatch[batchIndex++]);
+    handled++;
+  }
+
+  // Tell the caller how much is left so it can poll again right away
+  pollPending = 0;
+  if (stopped) {
+    // The hub thread delivers what SDL still has
+    int queued = hub.Threaded() ? 0
+                                : SDL_PeepEvents(nullptr, 0, SDL_PEEKEVENT,
+                                                 SDL_FIRSTEVENT, SDL_LASTEVENT);
+    if (queued > 0)
+      pollPending = queued;
+    pollPending += static_cast<int>(eventBatch.size() - batchIndex
+                                    + hub.Queued(&hubConsumer));
+  }
+
+  FinishPoll(env, sink);
+  return pollPending;
+}
+
+void SdlGameController::BeginPoll() {
+  if (counterFrequency == 0) {
+    // Start counting at a tick boundary so both clocks agree to a fraction
+    // of a millisecond
+    counterFrequency = SDL_GetPerformanceFrequency();
+    Uint32 tick = SDL_GetTicks();
+    while ((tickAtCounter = SDL_GetTicks()) == tick) {
+    }
+    counterAtTick = SDL_GetPerformanceCounter();
+  }
+
+  poll_number++;
+  pollStart = SDL_GetPerformanceCounter();
+  pollEventCount = 0;
+}
+
+void SdlGameController::CountEvent(const SDL_Event &event) {
+  int type = 0;
+  SDL_JoystickID which = -1;
+  switch (event.type) {
+    case SDL_CONTROLLERBUTTONDOWN:
+      type = RING_BUTTON_DOWN;
+      which = event.cbutton.which;
+      break;
+    case SDL_CONTROLLERBUTTONUP:
+      type = RING_BUTTON_UP;
+      which = event.cbutton.which;
+      break;
+    case SDL_CONTROLLERAXISMOTION:
+      type = RING_AXIS_MOTION;
+      which = event.caxis.which;
+      break;
+    case SDL_CONTROLLERDEVICEADDED:
+      type = RING_DEVICE_ADDED;
+      break;
+    case SDL_CONTROLLERDEVICEREMOVED:
+      type = RING_DEVICE_REMOVED;
+      break;
+    case SDL_CONTROLLERDEVICEREMAPPED:
+      type = RING_DEVICE_REMAPPED;
+      break;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    case SDL_CONTROLLERTOUCHPADDOWN:
+      type = RING_TOUCHPAD_DOWN;
+      which = event.ctouchpad.which;
+      break;
+    case SDL_CONTROLLERTOUCHPADMOTION:
+      type = RING_TOUCHPAD_MOTION;
+      which = event.ctouchpad.which;
+      break;
+    case SDL_CONTROLLERTOUCHPADUP:
+      type = RING_TOUCHPAD_UP;
+      which = event.ctouchpad.which;
+      break;
+    case SDL_CONTROLLERSENSORUPDATE:
+      type = RING_SENSOR_UPDATE;
+      which = event.csensor.which;
+      break;
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 24)
+    case SDL_JOYBATTERYUPDATED:
+      type = RING_BATTERY_UPDATE;
+      which = event.jbattery.which;
+      break;
+#endif
+  }
+  stats.events++;
+  stats.eventsByType[type]++;
+  pollEventCount++;
+  if (which >= 0) {
+    auto record = controllers.Find(which);
+    if (record)
+      record->events++;
+  }
+
+  // Time since the event was queued. SDL timestamps are whole milliseconds,
+  // so this reads up to 1ms high.
+  Uint64 elapsed = (SDL_GetPerformanceCounter() - counterAtTick) * 1000000
+                   / counterFrequency;
+  Uint32 tick = tickAtCounter + static_cast<Uint32>(elapsed / 1000);
+  int64_t age = static_cast<Sint32>(tick - event.common.timestamp) * 1000LL
+                + static_cast<int64_t>(elapsed % 1000);
+  stats.ageMicros.Add(age > 0 ? static_cast<uint64_t>(age) : 0);
+}
+
+void SdlGameController::FinishPoll(Napi::Env env, EventSink *sink) {
+  // Send whatever was held back to be merged during the poll
+  FlushAxisEvents(env, sink);
+  FlushSensorStreams(env, sink);
+  FlushOrientation(env, sink);
+  FlushTouchpad(env, sink);
+  FlushOutputs(env, sink);
+  FlushEffects(env, sink);
+
+  if (replayer.TakeFinished()) {
+    auto obj = Napi::Object::New(env);
+    obj.Set(Key(KEY_MESSAGE), "Replay finished");
+    obj.Set("pushed", replayer.Pushed());
+    obj.Set("skipped", replayer.Skipped());
+    Emit(sink, EVENT_REPLAY_DONE, obj);
+    UpdateWanted();
+  }
+
+  haptics.TakeFinished(&hapticsDone);
+  for (auto &done : hapticsDone) {
+    auto obj = Napi::Object::New(env);
+    obj.Set("id", done.id);
+    obj.Set(Key(KEY_WHICH), static_cast<int>(done.which));
+    int player = PlayerForInstance(done.which);
+    if (player >= 0)
+      obj.Set(Key(KEY_PLAYER), player);
+    obj.Set("cancelled", done.cancelled);
+    Emit(sink, EVENT_HAPTIC_DONE, obj);
+  }
+  hapticsDone.clear();
+
+  reflexes.TakeFired(&reflexesFired);
+  for (auto &fired : reflexesFired)
+    ReflexDone(env, sink, fired);
+  reflexesFired.clear();
+
+  // Events SDL could not queue never reach the hub, only their gaps do
+  uint64_t lost = EventHub::Instance().Lost();
+  if (lost > queueLostSeen) {
+    auto obj = Napi::Object::New(env);
+    obj.Set(Key(KEY_MESSAGE),
+            "SDL event queue was full, controller events were dropped");
+    obj.Set("dropped", static_cast<double>(lost - queueLostSeen));
+    obj.Set("operation", "SDL_PushEvent");
+    Emit(sink, EVENT_WARNING, obj);
+    queueLostSeen = lost;
+  }
+
+  stats.polls++;
+  stats.eventsPerPoll.Add(pollEventCount);
+  stats.pollMicros.Add((SDL_GetPerformanceCounter() - pollStart) * 1000000
+                       / counterFrequency);
+}
+
+void SdlGameController::DeliverEvent(Napi::Env env, EventSink *sink,
+                                     const SDL_Event &event) {
+  CountEvent(event);
+  if (recorder.IsOpen())
+    recorder.Write(event);
+
+  // Fusion sees every sample, whatever happens to the event afterwards
+  if (sensorFusion && event.type == SDL_CONTROLLERSENSORUPDATE)
+    FuseSensor(event);
+
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  // Gesture recognition replaces the raw touchpad events
+  if (touchpadGestures
+      && (event.type == SDL_CONTROLLERTOUCHPADDOWN
+          || event.type == SDL_CONTROLLERTOUCHPADMOTION
+          || event.type == SDL_CONTROLLERTOUCHPADUP)) {
+    TrackTouch(event);
+    return;
+  }
+#endif
+
+  if (event.type != SDL_CONTROLLERAXISMOTION) {
+    // Keep axis values ahead of the button or device event that followed
+    FlushAxisEvents(env, sink);
+    HandleEvent(env, sink, event);
+    // Combos see every press, after the event that completes them
+    if (!combos.Empty())
+      MatchCombos(env, sink, event);
+    return;
+  }
+
+  // Stick moves may be held back to be merged, combos take them as they come
+  if (!combos.Empty())
+    MatchCombos(env, sink, event);
+
+  if (axisCoalesce) {
+    for (auto &pending : pendingAxis) {
+      if (pending.caxis.which == event.caxis.which
+          && pending.caxis.axis == event.caxis.axis) {
+        pending = event;
+        stats.axisCoalesced++;
+        return;
+      }
+    }
+    pendingAxis.push_back(event);
+    return;
+  }
+
+  SDL_Event filtered = event;
+  if (FilterAxis(&filtered))
+    HandleEvent(env, sink, filtered);
+}
+
+void SdlGameController::FlushAxisEvents(Napi::Env env, EventSink *sink) {
+  if (pendingAxis.empty())
+    return;
+
+  for (auto &event : pendingAxis) {
+    if (FilterAxis(&event))
+      HandleEvent(env, sink, event);
+  }
+  pendingAxis.clear();
+}
+
+// Sensor time in microseconds. Older SDL versions only have the millisecond
+// event time.
+static double SensorTimestamp(const SDL_Event &event) {
+#if SDL_VERSION_ATLEAST(2, 26, 0)
+  if (event.csensor.timestamp_us)
+    return static_cast<double>(event.csensor.timestamp_us);
+#endif
+  return event.csensor.timestamp * 1000.0;
+}
+
+void SdlGameController::StreamSensor(const SDL_Event &event) {
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  SensorStream *stream = nullptr;
+  for (auto &candidate : sensorStreams) {
+    if (candidate.which == event.csensor.which
+        && candidate.sensor == event.csensor.sensor) {
+      stream = &candidate;
+      break;
+    }
+  }
+  if (stream == nullptr) {
+    sensorStreams.emplace_back();
+    stream = &sensorStreams.back();
+    stream->which = event.csensor.which;
+    stream->sensor = event.csensor.sensor;
+  }
+
+  double timestamp = SensorTimestamp(event);
+  const float *data = event.csensor.data;
+  if (sensorRate <= 0) {
+    stream->samples.insert(stream->samples.end(),
+                           {timestamp, data[0], data[1], data[2]});
+    return;
+  }
+
+  // Average everything that arrives within one output interval
+  if (stream->count == 0)
+    stream->windowStart = timestamp;
+  for (int i = 0; i < 3; i++)
+    stream->sum[i] += data[i];
+  stream->count++;
+
+  if (timestamp - stream->windowStart < 1e6 / sensorRate)
+    return;
+
+  stream->samples.insert(stream->samples.end(),
+                         {timestamp, stream->sum[0] / stream->count,
+                          stream->sum[1] / stream->count,
+                          stream->sum[2] / stream->count});
+  SDL_zero(stream->sum);
+  stream->count = 0;
+#else
+  (void) event;
+#endif
+}
+
+void SdlGameController::FlushSensorStreams(Napi::Env env, EventSink *sink) {
+  for (auto &stream : sensorStreams) {
+    if (stream.samples.empty())
+      continue;
+
+    auto samples = Napi::Float64Array::New(env, stream.samples.size());
+    SDL_memcpy(samples.Data(), stream.samples.data(),
+               stream.samples.size() * sizeof(double));
+
+    auto obj = Napi::Object::New(env);
+    obj.Set(Key(KEY_WHICH), static_cast<int>(stream.which));
+    int player = PlayerForInstance(stream.which);
+    if (player >= 0)
+      obj.Set(Key(KEY_PLAYER), player);
+    if (stream.sensor == SDL_SENSOR_GYRO)
+      obj.Set(Key(KEY_SENSOR), EventName(EVENT_GYROSCOPE));
+    else if (stream.sensor == SDL_SENSOR_ACCEL)
+      obj.Set(Key(KEY_SENSOR), EventName(EVENT_ACCELEROMETER));
+    else
+      obj.Set(Key(KEY_SENSOR), "unknown");
+
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+    auto record = controllers.Find(stream.which);
+    if (record) {
+      obj.Set("rate", SDL_GameControllerGetSensorDataRate(
+                        record->controller, (SDL_SensorType) stream.sensor));
+    }
+#endif
+    if (sensorRate > 0)
+      obj.Set("output_rate", sensorRate);
+    obj.Set("count", stream.samples.size() / 4);
+    obj.Set("samples", samples);
+    Emit(sink, EVENT_SENSOR_BATCH, obj);
+    stream.samples.clear();
+  }
+}
+
+void SdlGameController::FuseSensor(const SDL_Event &event) {
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  auto search = fusion.find(event.csensor.which);
+  if (search == fusion.end())
+    search = fusion.emplace(event.csensor.which, FusionState(fusionBeta)).first;
+  FusionState &state = search->second;
+
+  if (event.csensor.sensor == SDL_SENSOR_ACCEL) {
+    state.filter.Accelerometer(event.csensor.data);
+  } else if (event.csensor.sensor == SDL_SENSOR_GYRO) {
+    double timestamp = SensorTimestamp(event);
+    double dt = (timestamp - state.lastGyroTimestamp) / 1e6;
+    // First sample or a gap in the data, nothing to integrate over
+    if (state.lastGyroTimestamp == 0 || dt > 0.1)
+      dt = 0;
+    state.lastGyroTimestamp = timestamp;
+    state.filter.Gyroscope(event.csensor.data, static_cast<float>(dt));
+    state.updated = true;
+  }
+#else
+  (void) event;
+#endif
+}
+
+Napi::Object SdlGameController::Orientation(Napi::Env env,
+                                            SDL_JoystickID which,
+                                            const FusionState &state) {
+  auto obj = Napi::Object::New(env);
+  obj.Set(Key(KEY_WHICH), static_cast<int>(which));
+  int player = PlayerForInstance(which);
+  if (player >= 0)
+    obj.Set(Key(KEY_PLAYER), player);
+
+  const float *q = state.filter.Quaternion();
+  obj.Set("w", q[0]);
+  obj.Set(Key(KEY_X), q[1]);
+  obj.Set(Key(KEY_Y), q[2]);
+  obj.Set(Key(KEY_Z), q[3]);
+  obj.Set("calibrated", state.filter.Calibrated());
+  return obj;
+}
+
+void SdlGameController::FlushOrientation(Napi::Env env, EventSink *sink) {
+  if (fusion.empty() || !Wanted(EVENT_ORIENTATION))
+    return;
+
+  // The filter runs at the sensor rate, the event is sent at a lower one
+  Uint32 now = SDL_GetTicks();
+  if (orientationRate > 0 && lastOrientationTicks != 0
+      && now - lastOrientationTicks < 1000.0 / orientationRate)
+    return;
+  lastOrientationTicks = now;
+
+  for (auto &entry : fusion) {
+    if (!entry.second.updated)
+      continue;
+    entry.second.updated = false;
+    Emit(sink, EVENT_ORIENTATION, Orientation(env, entry.first, entry.second));
+  }
+}
+
+void SdlGameController::TrackTouch(const SDL_Event &event) {
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  auto &touch = event.ctouchpad;
+  TouchGestures &gestures = touchGestures[touch.which];
+  int state = 0;
+  switch (event.type) {
+    case SDL_CONTROLLERTOUCHPADDOWN:
+      gestures.Down(touch.touchpad, touch.finger, touch.x, touch.y,
+                    touch.timestamp);
+      state = 1;
+      break;
+    case SDL_CONTROLLERTOUCHPADMOTION:
+      gestures.Motion(touch.touchpad, touch.finger, touch.x, touch.y,
+                      touch.timestamp);
+      state = 2;
+      break;
+    case SDL_CONTROLLERTOUCHPADUP:
+      gestures.Up(touch.touchpad, touch.finger, touch.x, touch.y,
+                  touch.timestamp);
+      state = 3;
+      break;
+  }
+
+  if (touchpadRaw && Wanted(EVENT_TOUCHPAD_BATCH)) {
+    touchpadSamples.insert(
+      touchpadSamples.end(),
+      {static_cast<double>(touch.timestamp), static_cast<double>(touch.which),
+       static_cast<double>(touch.touchpad), static_cast<double>(touch.finger),
+       static_cast<double>(state), touch.x, touch.y, touch.pressure});
+  }
+#else
+  (void) event;
+#endif
+}
+
+void SdlGameController::FlushTouchpad(Napi::Env env, EventSink *sink) {
+  static const char *const GESTURE_NAMES[] = {"tap", "swipe", "pinch",
+                                              "scroll"};
+
+  for (auto &entry : touchGestures) {
+    entry.second.Take(&gestureBatch);
+    if (gestureBatch.empty())
+      continue;
+
+    int player = PlayerForInstance(entry.first);
+    for (auto &gesture : gestureBatch) {
+      auto obj = Napi::Object::New(env);
+      obj.Set("gesture", GESTURE_NAMES[gesture.type]);
+      obj.Set(Key(KEY_WHICH), static_cast<int>(entry.first));
+      if (player >= 0)
+        obj.Set(Key(KEY_PLAYER), player);
+      obj.Set(Key(KEY_TOUCHPAD), gesture.touchpad);
+      obj.Set("fingers", gesture.fingers);
+      obj.Set(Key(KEY_X), gesture.x);
+      obj.Set(Key(KEY_Y), gesture.y);
+      obj.Set("duration_ms", gesture.duration);
+      switch (gesture.type) {
+        case GESTURE_SWIPE:
+        case GESTURE_SCROLL:
+          obj.Set("dx", gesture.dx);
+          obj.Set("dy", gesture.dy);
+          break;
+        case GESTURE_PINCH:
+          obj.Set("scale", gesture.scale);
+          break;
+        default:
+          break;
+      }
+      if (gesture.type == GESTURE_PINCH || gesture.type == GESTURE_SCROLL)
+        obj.Set("end", gesture.end);
+      Emit(sink, EVENT_TOUCHPAD_GESTURE, obj);
+    }
+    gestureBatch.clear();
+  }
+
+  if (touchpadSamples.empty())
+    return;
+
+  auto samples = Napi::Float64Array::New(env, touchpadSamples.size());
+  SDL_memcpy(samples.Data(), touchpadSamples.data(),
+             touchpadSamples.size() * sizeof(double));
+  auto obj = Napi::Object::New(env);
+  obj.Set("count", touchpadSamples.size() / 8);
+  obj.Set("samples", samples);
+  Emit(sink, EVENT_TOUCHPAD_BATCH, obj);
+  touchpadSamples.clear();
+}
+
+Napi::Value
+SdlGameController::startRecording(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+
+  if (info.Length() < 1 || !info[0].IsString()) {
+    auto warning = Napi::Object::New(env);
+    warning.Set("message", "wrong argument type: path");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Boolean::New(env, false);
+  }
+
+  if (!recorder.Open(info[0].As<Napi::String>().Utf8Value())) {
+    auto obj = Napi::Object::New(env);
+    obj.Set("message", recorder.Error());
+    obj.Set("operation", "startRecording");
+    emit({EventName(EVENT_ERROR), obj});
+    return Napi::Boolean::New(env, false);
+  }
+  UpdateWanted();
+  return Napi::Boolean::New(env, true);
+}
+
+Napi::Value
+SdlGameController::stopRecording(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  bool failed = !recorder.IsOpen() && !recorder.Error().empty();
+  auto count = recorder.Close();
+  UpdateWanted();
+
+  // Writing stops at the first error, let the caller know the trace is short
+  if (failed) {
+    auto warning = Napi::Object::New(env);
+    warning.Set("message", "Recording stopped early: " + recorder.Error());
+    warning.Set("operation", "stopRecording");
+    Emitter(info)({EventName(EVENT_WARNING), warning});
+  }
+  return Napi::Number::New(env, static_cast<double>(count));
+}
+
+Napi::Value SdlGameController::replay(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+
+  if (info.Length() < 1 || !info[0].IsString()) {
+    auto warning = Napi::Object::New(env);
+    warning.Set("message", "wrong argument type: path");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Boolean::New(env, false);
+  }
+
+  double speed = 1;
+  if (info.Length() > 1 && info[1].IsNumber())
+    speed = info[1].As<Napi::Number>().DoubleValue();
+
+  if (!InitSdl(env, emit)) {
+    auto obj = Napi::Object::New(env);
+    obj.Set("message", "SDL is still starting, wait for init()");
+    obj.Set("operation", "replay");
+    emit({EventName(EVENT_WARNING), obj});
+    return Napi::Boolean::New(env, false);
+  }
+  if (!replayer.Start(info[0].As<Napi::String>().Utf8Value(), speed)) {
+    auto obj = Napi::Object::New(env);
+    obj.Set("message", replayer.Error());
+    obj.Set("operation", "replay");
+    emit({EventName(EVENT_ERROR), obj});
+    return Napi::Boolean::New(env, false);
+  }
+  UpdateWanted();
+  return Napi::Boolean::New(env, true);
+}
+
+void SdlGameController::stopReplay(const Napi::CallbackInfo &info) {
+  (void) info;
+  replayer.Stop();
+  UpdateWanted();
+}
+
+Napi::Value SdlGameController::attachVirtual(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+  if (!InitSdl(env, emit)) {
+    auto obj = Napi::Object::New(env);
+    obj.Set("message", "SDL is still starting, wait for init()");
+    obj.Set("operation", "attachVirtual");
+    emit({EventName(EVENT_WARNING), obj});
+    return Napi::Number::New(env, -1);
+  }
+
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  // Axes and buttons are in SDL game controller order
+  int device_index = SDL_JoystickAttachVirtual(
+    SDL_JOYSTICK_TYPE_GAMECONTROLLER, SDL_CONTROLLER_AXIS_MAX,
+    SDL_CONTROLLER_BUTTON_MAX, 0);
+  SDL_Joystick *joystick = nullptr;
+  if (device_index >= 0)
+    joystick = SDL_JoystickOpen(device_index);
+  if (joystick == nullptr) {
+    auto obj = Napi::Object::New(env);
+    obj.Set("message", SDL_GetError());
+    obj.Set("operation", "SDL_JoystickAttachVirtual");
+    emit({EventName(EVENT_ERROR), obj});
+    if (device_index >= 0)
+      SDL_JoystickDetachVirtual(device_index);
+    return Napi::Number::New(env, -1);
+  }
+
+  SDL_JoystickID id = SDL_JoystickInstanceID(joystick);
+  virtualJoysticks[id] = joystick;
+  return Napi::Number::New(env, id);
+#else
+  auto warning = Napi::Object::New(env);
+  warning.Set("message", "Virtual controllers require SDL 2.0.14");
+  emit({EventName(EVENT_WARNING), warning});
+  return Napi::Number::New(env, -1);
+#endif
+}
+
+Napi::Value SdlGameController::setVirtual(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsString()
+      || !info[2].IsNumber()) {
+    auto warning = Napi::Object::New(env);
+    warning.Set("message", "wrong argument type: id, button, value");
+    Emitter(info)({EventName(EVENT_WARNING), warning});
+    return Napi::Boolean::New(env, false);
+  }
+
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  auto search = virtualJoysticks.find(info[0].As<Napi::Number>().Int32Value());
+  if (search == virtualJoysticks.end())
+    return Napi::Boolean::New(env, false);
+
+  // Applied by SDL on the next poll, which then sends the usual events
+  std::string name = info[1].As<Napi::String>().Utf8Value();
+  int value = info[2].As<Napi::Number>().Int32Value();
+  int result = -1;
+  auto axis = SDL_GameControllerGetAxisFromString(name.c_str());
+  if (axis != SDL_CONTROLLER_AXIS_INVALID) {
+    result = SDL_JoystickSetVirtualAxis(search->second, axis,
+                                        static_cast<Sint16>(value));
+  } else {
+    auto button = SDL_GameControllerGetButtonFromString(name.c_str());
+    if (button != SDL_CONTROLLER_BUTTON_INVALID)
+      result = SDL_JoystickSetVirtualButton(search->second, button,
+                                            value ? SDL_PRESSED : SDL_RELEASED);
+  }
+  return Napi::Boolean::New(env, result == 0);
+#else
+  return Napi::Boolean::New(env, false);
+#endif
+}
+
+void SdlGameController::detachVirtual(const Napi::CallbackInfo &info) {
+  if (info.Length() < 1 || !info[0].IsNumber())
+    return;
+
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  SDL_JoystickID id = info[0].As<Napi::Number>().Int32Value();
+  auto search = virtualJoysticks.find(id);
+  if (search == virtualJoysticks.end())
+    return;
+
+  SDL_JoystickClose(search->second);
+  virtualJoysticks.erase(search);
+  // Detaching takes the device index, which may have changed since attach
+  for (int device_index = 0; device_index < SDL_NumJoysticks();
+       device_index++) {
+    if (SDL_JoystickGetDeviceInstanceID(device_index) == id) {
+      SDL_JoystickDetachVirtual(device_index);
+      break;
+    }
+  }
+#endif
+}
+
+Napi::Object SdlGameController::HistogramObject(Napi::Env env,
+                                                const Histogram &h) {
+  auto buckets = Napi::Array::New(env, HISTOGRAM_BUCKETS);
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    buckets.Set(i, static_cast<double>(h.counts[i]));
+
+  auto obj = Napi::Object::New(env);
+  obj.Set("count", static_cast<double>(h.count));
+  obj.Set("mean", h.count ? static_cast<double>(h.sum) / h.count : 0);
+  obj.Set("max", static_cast<double>(h.max));
+  obj.Set("buckets", buckets);
+  return obj;
+}
+
+Napi::Value SdlGameController::getStats(const Napi::CallbackInfo &info) {
+  static const char *const TYPE_NAMES[] = {
+    "other",           "button_down",    "button_up",
+    "axis_motion",     "device_added",   "device_removed",
+    "device_remapped", "touchpad_down",  "touchpad_motion",
+    "touchpad_up",     "sensor_update",  "battery_update"};
+  static_assert(sizeof(TYPE_NAMES) / sizeof(TYPE_NAMES[0])
+                  == RING_BATTERY_UPDATE + 1,
+                "TYPE_NAMES must match RingEventType");
+
+  Napi::Env env = info.Env();
+  auto byType = Napi::Object::New(env);
+  for (int type = 0; type <= RING_BATTERY_UPDATE; type++)
+    byType.Set(TYPE_NAMES[type], static_cast<double>(stats.eventsByType[type]));
+
+  auto dropped = Napi::Object::New(env);
+  dropped.Set("unsubscribed", static_cast<double>(stats.unsubscribed));
+  dropped.Set("axis_coalesced", static_cast<double>(stats.axisCoalesced));
+  dropped.Set("axis_filtered", static_cast<double>(stats.axisFiltered));
+  dropped.Set("poll_overruns", static_cast<double>(stats.pollOverruns));
+  dropped.Set("filtered", static_cast<double>(hubConsumer.filtered));
+  dropped.Set("inbox_full", static_cast<double>(hubConsumer.overflowed));
+  dropped.Set("sdl_queue_full",
+              static_cast<double>(EventHub::Instance().Lost()));
+  if (ringData != nullptr)
+    dropped.Set("ring_full", ringData[RING_DROPPED]);
+
+  auto obj = Napi::Object::New(env);
+  obj.Set("polls", static_cast<double>(stats.polls));
+  obj.Set("events", static_cast<double>(stats.events));
+  obj.Set("events_by_type", byType);
+  obj.Set("dropped", dropped);
+  obj.Set("events_per_poll", HistogramObject(env, stats.eventsPerPoll));
+  obj.Set("poll_us", HistogramObject(env, stats.pollMicros));
+  obj.Set("age_us", HistogramObject(env, stats.ageMicros));
+
+  auto perController = Napi::Array::New(env);
+  uint32_t length = 0;
+  for (auto &controller : controllers) {
+    auto entry = Napi::Object::New(env);
+    entry.Set(Key(KEY_PLAYER), controller.player);
+    entry.Set(Key(KEY_WHICH), static_cast<int>(controller.which));
+    entry.Set("events", static_cast<double>(controller.events));
+    entry.Set("outputs", static_cast<double>(controller.outputs));
+    entry.Set("effects_unchanged",
+              static_cast<double>(controller.effectsUnchanged));
+    perController.Set(length++, entry);
+  }
+  obj.Set("controllers", perController);
+
+  if (info.Length() > 0 && info[0].ToBoolean()) {
+    stats = PollStats();
+    for (auto &controller : controllers) {
+      controller.events = 0;
+      controller.outputs = 0;
+    }
+    hubConsumer.filtered = 0;
+    hubConsumer.overflowed = 0;
+  }
+  return obj;
+}
+
+Napi::Value
+SdlGameController::getOrientation(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  // A single player, or every controller with sensor data
+  if (info.Length() > 0 && info[0].IsNumber()) {
+    int player = info[0].As<Napi::Number>().Int32Value();
+    for (auto &entry : fusion) {
+      if (PlayerForInstance(entry.first) == player)
+        return Orientation(env, entry.first, entry.second);
+    }
+    return env.Undefined();
+  }
+
+  auto orientations = Napi::Array::New(env);
+  uint32_t length = 0;
+  for (auto &entry : fusion) {
+    orientations.Set(length++, Orientation(env, entry.first, entry.second));
+  }
+  return orientations;
+}
+
+bool SdlGameController::FilterAxis(SDL_Event *event) {
+  if (!axisFilter)
+    return true;
+
+  int axis = event->caxis.axis;
+  if (axis < 0 || axis >= SDL_CONTROLLER_AXIS_MAX)
+    return true;
+
+  Sint16 value = event->caxis.value;
+  if (value > -axisDeadzone[axis] && value < axisDeadzone[axis])
+    value = 0;
+
+  // Unknown controllers start at rest, the map entry is zero filled
+  Sint16 &last = lastAxis[event->caxis.which][axis];
+  int delta = value - last;
+  // Always let the axis settle back to rest
+  if (delta == 0
+      || (value != 0 && delta > -axisThreshold[axis]
+          && delta < axisThreshold[axis])) {
+    stats.axisFiltered++;
+    return false;
+  }
+
+  last = value;
+  event->caxis.value = value;
+  return true;
+}
+
+void SdlGameController::Emit(EventSink *sink, int id, Napi::Object obj) {
+  if (sink->batching) {
+    obj.Set(Key(KEY_EVENT), EventName(id));
+    sink->batch.Set(sink->length++, obj);
+  } else if (Wanted(id)) {
+    sink->emit({EventName(id), obj});
+  }
+}
+
+void SdlGameController::EmitAlias(EventSink *sink, int id, Napi::Object obj) {
+  // Batches only carry the main event, aliases are derived from it in JS
+  if (!sink->batching && Wanted(id))
+    sink->emit({EventName(id), obj});
+}
+
+int SdlGameController::ButtonEventId(int button, ButtonAlias alias) {
+  return EVENT_BUTTON_FIRST + 3 * button + alias;
+}
+
+bool SdlGameController::Wanted(int id) const {
+  if (!listenerAware || id >= EVENT_MASKABLE_COUNT)
+    return true;
+  return id >= 0 && subscriptions[id];
+}
+
+bool SdlGameController::Subscribed(const SDL_Event &event) const {
+  if (!listenerAware)
+    return true;
+
+  int button;
+  switch (event.type) {
+    case SDL_CONTROLLERAXISMOTION:
+      return Wanted(EVENT_CONTROLLER_AXIS_MOTION)
+             || Wanted(EVENT_AXIS_FIRST + event.caxis.axis);
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+      button = event.cbutton.button;
+      if (event.type == SDL_CONTROLLERBUTTONDOWN)
+        return Wanted(EVENT_CONTROLLER_BUTTON_DOWN)
+               || Wanted(ButtonEventId(button))
+               || Wanted(ButtonEventId(button, BUTTON_ALIAS_DOWN));
+      return Wanted(EVENT_CONTROLLER_BUTTON_UP) || Wanted(ButtonEventId(button))
+             || Wanted(ButtonEventId(button, BUTTON_ALIAS_UP));
+    case SDL_CONTROLLERDEVICEREMAPPED:
+      return Wanted(EVENT_CONTROLLER_DEVICE_REMAPPED);
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    case SDL_CONTROLLERTOUCHPADDOWN:
+      return Wanted(EVENT_CONTROLLER_TOUCHPAD_DOWN);
+    case SDL_CONTROLLERTOUCHPADMOTION:
+      return Wanted(EVENT_CONTROLLER_TOUCHPAD_MOTION);
+    case SDL_CONTROLLERTOUCHPADUP:
+      return Wanted(EVENT_CONTROLLER_TOUCHPAD_UP);
+    case SDL_CONTROLLERSENSORUPDATE:
+      switch (event.csensor.sensor) {
+        case SDL_SENSOR_GYRO:
+          if (Wanted(EVENT_GYROSCOPE))
+            return true;
+          break;
+        case SDL_SENSOR_ACCEL:
+          if (Wanted(EVENT_ACCELEROMETER))
+            return true;
+          break;
+      }
+      return Wanted(EVENT_CONTROLLER_SENSOR_UPDATE);
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 24)
+    case SDL_JOYBATTERYUPDATED:
+      return Wanted(EVENT_CONTROLLER_BATTERY_UPDATE);
+#endif
+    default:
+      // device added and removed change our state and are always handled
+      return true;
+  }
+}
+
+void SdlGameController::subscribe(const Napi::CallbackInfo &info) {
+  if (info.Length() < 1 || !info[0].IsString())
+    return;
+
+  bool on = true;
+  if (info.Length() > 1)
+    on = info[1].ToBoolean();
+
+  auto search = eventIds.find(info[0].As<Napi::String>().Utf8Value());
+  if (search != eventIds.end()) {
+    subscriptions[search->second] = on;
+    UpdateWanted();
+  }
+}
+
+// Event classes this instance does something with. Everything when events
+// are kept whatever listens, as by rings, recordings and replays.
+uint32_t SdlGameController::WantedClasses() const {
+  if (!listenerAware || ringData != nullptr || recorder.IsOpen()
+      || replayer.Running())
+    return EVENT_CLASS_ALL;
+
+  uint32_t classes = 0;
+  bool axis = Wanted(EVENT_CONTROLLER_AXIS_MOTION);
+  for (int id = EVENT_AXIS_FIRST; id < EVENT_BUTTON_FIRST; id++)
+    axis = axis || Wanted(id);
+  if (axis)
+    classes |= EVENT_CLASS_AXIS;
+
+  bool button = Wanted(EVENT_CONTROLLER_BUTTON_DOWN)
+                || Wanted(EVENT_CONTROLLER_BUTTON_UP);
+  for (int id = EVENT_BUTTON_FIRST; id < EVENT_MASKABLE_COUNT; id++)
+    button = button || Wanted(id);
+  if (button)
+    classes |= EVENT_CLASS_BUTTON;
+
+  if (touchpadGestures || Wanted(EVENT_CONTROLLER_TOUCHPAD_DOWN)
+      || Wanted(EVENT_CONTROLLER_TOUCHPAD_MOTION)
+      || Wanted(EVENT_CONTROLLER_TOUCHPAD_UP))
+    classes |= EVENT_CLASS_TOUCHPAD;
+  if (sensorFusion || Wanted(EVENT_SENSOR_BATCH)
+      || Wanted(EVENT_CONTROLLER_SENSOR_UPDATE) || Wanted(EVENT_GYROSCOPE)
+      || Wanted(EVENT_ACCELEROMETER))
+    classes |= EVENT_CLASS_SENSOR;
+  if (Wanted(EVENT_CONTROLLER_BATTERY_UPDATE))
+    classes |= EVENT_CLASS_BATTERY;
+  return classes | combos.Classes();
+}
+
+void SdlGameController::UpdateWanted() {
+  EventHub::Instance().SetWanted(&hubConsumer, WantedClasses(),
+                                 reflexes.Classes());
+}
+
+void SdlGameController::setFilter(const Napi::CallbackInfo &info) {
+  HubFilter filter;
+  if (info.Length() > 0)
+    filter = ReadFilter(info[0]);
+  EventHub::Instance().SetFilter(&hubConsumer, filter);
+}
+
+Napi::Value
+SdlGameController::startEventThread(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  if (eventThreadRunning)
+    return Napi::Boolean::New(env, true);
+
+  Napi::Function emit = Emitter(info);
+
+  if (!InitSdl(env, emit))
+    return Napi::Boolean::New(env, false);
+  // With video, SDL has to be pumped on the thread that started it
+  if (!sdlHeadless)
+    return Napi::Boolean::New(env, false);
+
+  // The bound emit keeps this object alive while the thread is running
+  eventThreadFn = Napi::ThreadSafeFunction::New(
+    env, emit, "SdlGameControllerEventThread", 0, 1);
+  eventThreadRunning = true;
+  // Called with the hub locked, only when our inbox was empty, so there is
+  // one call per batch and the JS side drains whatever has queued up
+  EventHub::Instance().StartThread(&hubConsumer, [this]() {
+    eventThreadFn.NonBlockingCall([this](Napi::Env env, Napi::Function emit) {
+      DrainEventQueue(env, emit);
+    });
+  });
+  return Napi::Boolean::New(env, true);
+}
+
+void SdlGameController::stopEventThread(const Napi::CallbackInfo &info) {
+  (void) info;
+  StopEventThread();
+}
+
+void SdlGameController::StopEventThread() {
+  if (!eventThreadRunning)
+    return;
+
+  eventThreadRunning = false;
+  // The hub thread keeps running while other instances use it
+  EventHub::Instance().StopThread(&hubConsumer);
+  eventThreadFn.Release();
+}
+
+void SdlGameController::DrainEventQueue(Napi::Env env, Napi::Function emit) {
+  // env is null when the thread safe function is being torn down
+  if (env == nullptr)
+    return;
+
+  EventSink sink;
+  sink.emit = emit;
+  if (batchMode) {
+    sink.batching = true;
+    sink.batch = Napi::Array::New(env);
+  }
+
+  BeginPoll();
+  EventHub::Instance().Take(&hubConsumer, &eventBatch);
+  for (; batchIndex < eventBatch.size(); batchIndex++) {
+    DeliverEvent(env, &sink, eventBatch[batchIndex]);
+  }
+  FinishPoll(env, &sink);
+  eventBatch.clear();
+  batchIndex = 0;
+
+  if (sink.length > 0)
+    emit({EventName(EVENT_BATCH), sink.batch});
+}
+
+Napi::Value SdlGameController::pushEvent(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+
+  auto warning = Napi::Object::New(env);
+  if (!InitSdl(env, emit)) {
+    warning.Set("message", "SDL is still starting, wait for init()");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+  if (info.Length() < 2 || !info[0].IsString() || !info[1].IsString()) {
+    warning.Set("message", "wrong argument type: eventName, button");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+
+  auto eventName = info[0].As<Napi::String>().Utf8Value();
+  auto name = info[1].As<Napi::String>().Utf8Value();
+  int value = 0;
+  int count = 1;
+  if (info.Length() > 2 && info[2].IsNumber())
+    value = info[2].ToNumber();
+  if (info.Length() > 3 && info[3].IsNumber())
+    count = info[3].ToNumber();
+
+  // Pushed events come from a controller that does not exist
+  SDL_Event event;
+  SDL_zero(event);
+  const char *unknown = nullptr;
+  if (eventName == "controller-axis-motion") {
+    auto axis = SDL_GameControllerGetAxisFromString(name.c_str());
+    if (axis == SDL_CONTROLLER_AXIS_INVALID)
+      unknown = "unsupported axis: ";
+    event.type = SDL_CONTROLLERAXISMOTION;
+    event.caxis.which = -1;
+    event.caxis.axis = static_cast<Uint8>(axis);
+    event.caxis.value = static_cast<Sint16>(value);
+  } else if (eventName == "controller-button-down"
+             || eventName == "controller-button-up") {
+    auto button = SDL_GameControllerGetButtonFromString(name.c_str());
+    if (button == SDL_CONTROLLER_BUTTON_INVALID)
+      unknown = "unsupported button: ";
+    bool down = eventName == "controller-button-down";
+    event.type = down ? SDL_CONTROLLERBUTTONDOWN : SDL_CONTROLLERBUTTONUP;
+    event.cbutton.which = -1;
+    event.cbutton.button = static_cast<Uint8>(button);
+    event.cbutton.state = down ? SDL_PRESSED : SDL_RELEASED;
+  } else {
+    warning.Set("message", "unsupported event: " + eventName);
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+  if (unknown != nullptr) {
+    warning.Set("message", unknown + name);
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+
+  int pushed = 0;
+  while (pushed < count && SDL_PushEvent(&event) == 1) {
+    pushed++;
+  }
+  return Napi::Number::New(env, pushed);
+}
+
+Napi::Value SdlGameController::attachRing(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+
+  auto warning = Napi::Object::New(env);
+  if (info.Length() < 1 || !info[0].IsTypedArray()
+      || info[0].As<Napi::TypedArray>().TypedArrayType()
+           != napi_int32_array) {
+    warning.Set("message", "wrong argument type: ring must be an Int32Array");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Boolean::New(env, false);
+  }
+
+  auto ring = info[0].As<Napi::Int32Array>();
+  size_t capacity = 0;
+  if (ring.ElementLength() > RING_HEADER_WORDS)
+    capacity = (ring.ElementLength() - RING_HEADER_WORDS) / RING_RECORD_WORDS;
+  if (capacity < 2) {
+    warning.Set("message", "ring is too small");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Boolean::New(env, false);
+  }
+
+  // Hold on to the array so its memory stays put while we write into it
+  ringRef = Napi::Persistent(ring);
+  ringData = ring.Data();
+  ringCapacity = static_cast<int32_t>(capacity);
+
+  SDL_memset(ringData, 0, RING_HEADER_WORDS * sizeof(int32_t));
+  ringData[RING_CAPACITY] = ringCapacity;
+  ringData[RING_RECORD_SIZE] = RING_RECORD_WORDS;
+  UpdateWanted();
+  return Napi::Boolean::New(env, true);
+}
+
+void SdlGameController::detachRing(const Napi::CallbackInfo &info) {
+  (void) info;
+  ringData = nullptr;
+  ringCapacity = 0;
+  ringRef.Reset();
+  UpdateWanted();
+}
+
+Napi::Value SdlGameController::getState(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  // Read the devices directly instead of waiting for their events. Only
+  // one thread may pump SDL, and the hub thread keeps them current itself.
+  if (InitSdl(env, Emitter(info)) && !EventHub::Instance().Threaded())
+    SDL_GameControllerUpdate();
+
+  size_t length =
+    STATE_HEADER_WORDS + controllers.Size() * STATE_RECORD_WORDS;
+  Napi::Int16Array state;
+  if (info.Length() > 0 && info[0].IsTypedArray()
+      && info[0].As<Napi::TypedArray>().TypedArrayType() == napi_int16_array
+      && info[0].As<Napi::Int16Array>().ElementLength() >= length) {
+    state = info[0].As<Napi::Int16Array>();
+  } else {
+    // Only allocate when the caller's array is missing or too small
+    state = Napi::Int16Array::New(env, length);
+  }
+
+  int16_t *data = state.Data();
+  size_t count = 0;
+  for (auto &controller : controllers) {
+    int16_t *record = data + STATE_HEADER_WORDS + count * STATE_RECORD_WORDS;
+    record[STATE_PLAYER] = (int16_t) controller.player;
+    record[STATE_WHICH] = (int16_t) controller.which;
+    for (int axis = 0; axis < SDL_CONTROLLER_AXIS_MAX; axis++) {
+      record[STATE_AXES + axis] = SDL_GameControllerGetAxis(
+        controller.controller, (SDL_GameControllerAxis) axis);
+    }
+    for (int button = 0; button < SDL_CONTROLLER_BUTTON_MAX; button++) {
+      record[STATE_BUTTONS + button] = SDL_GameControllerGetButton(
+        controller.controller, (SDL_GameControllerButton) button);
+    }
+    count++;
+  }
+
+  data[STATE_COUNT] = (int16_t) count;
+  data[STATE_STRIDE] = STATE_RECORD_WORDS;
+  return state;
 }
 
-Napi::Value SdlGameController::pollEvents(const Napi::CallbackInfo &info) {
-  // do not spend too long here
-  auto start = std::chrono::system_clock::now();
-  this->poll_number++;
+// JS reads head and writes tail with Atomics on the same memory
+static std::atomic<int32_t> *RingWord(int32_t *word) {
+  static_assert(sizeof(std::atomic<int32_t>) == sizeof(int32_t),
+                "ring indices must be plain 32 bit words");
+  return reinterpret_cast<std::atomic<int32_t> *>(word);
+}
 
-  Napi::Env env = info.Env();
-  Napi::Function emit_unbound =
-    info.This().As<Napi::Object>().Get("emit").As<Napi::Function>();
-  Napi::Function emit = emit_unbound.Get("bind")
-                          .As<Napi::Function>()
-                          .Call(emit_unbound, {info.This()})
-                          .As<Napi::Function>();
-
-  // Set up SDL
-  if (!SdlGameController::sdlInit) {
-    SDL_SetHint(SDL_HINT_ACCELEROMETER_AS_JOYSTICK, "0");
-#if SDL_VERSION_ATLEAST(2, 0, 16)
-    SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_JOY_CONS, "1");
-#endif
-#if SDL_VERSION_ATLEAST(2, 0, 10)
-    SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_PS4_RUMBLE, "1");
-#endif
-#if SDL_VERSION_ATLEAST(2, 0, 16)
-    SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_PS5_RUMBLE, "1");
-#endif
-    SDL_SetHint(SDL_HINT_JOYSTICK_ALLOW_BACKGROUND_EVENTS, "1");
-#if SDL_VERSION_ATLEAST(2, 0, 22)
-    if (this->hints.count("sdl_joystick_rog_chakram") > 0) {
-      SDL_SetHint(SDL_HINT_JOYSTICK_ROG_CHAKRAM, "1");
-    }
+bool SdlGameController::WriteRing(const SDL_Event &event) {
+  int32_t type = 0;
+  int32_t which = 0;
+  int32_t code = 0;
+  int32_t value = 0;
+  float data[3] = {0, 0, 0};
+
+  switch (event.type) {
+    case SDL_CONTROLLERDEVICEADDED:
+      type = RING_DEVICE_ADDED;
+      which = SDL_JoystickGetDeviceInstanceID(event.cdevice.which);
+      break;
+    case SDL_CONTROLLERDEVICEREMOVED:
+      type = RING_DEVICE_REMOVED;
+      which = event.cdevice.which;
+      break;
+    case SDL_CONTROLLERDEVICEREMAPPED:
+      type = RING_DEVICE_REMAPPED;
+      which = event.cdevice.which;
+      break;
+    case SDL_CONTROLLERAXISMOTION:
+      type = RING_AXIS_MOTION;
+      which = event.caxis.which;
+      code = event.caxis.axis;
+      value = event.caxis.value;
+      break;
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+      type = RING_BUTTON_UP;
+      if (event.type == SDL_CONTROLLERBUTTONDOWN)
+        type = RING_BUTTON_DOWN;
+      which = event.cbutton.which;
+      code = event.cbutton.button;
+      value = event.cbutton.state;
+      break;
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+    case SDL_CONTROLLERTOUCHPADDOWN:
+    case SDL_CONTROLLERTOUCHPADMOTION:
+    case SDL_CONTROLLERTOUCHPADUP:
+      type = RING_TOUCHPAD_MOTION;
+      if (event.type == SDL_CONTROLLERTOUCHPADDOWN)
+        type = RING_TOUCHPAD_DOWN;
+      else if (event.type == SDL_CONTROLLERTOUCHPADUP)
+        type = RING_TOUCHPAD_UP;
+      which = event.ctouchpad.which;
+      code = event.ctouchpad.touchpad;
+      value = event.ctouchpad.finger;
+      data[0] = event.ctouchpad.x;
+      data[1] = event.ctouchpad.y;
+      data[2] = event.ctouchpad.pressure;
+      break;
+    case SDL_CONTROLLERSENSORUPDATE:
+      type = RING_SENSOR_UPDATE;
+      which = event.csensor.which;
+      code = event.csensor.sensor;
+      SDL_memcpy(data, event.csensor.data, sizeof(data));
+      break;
 #endif
 #if SDL_VERSION_ATLEAST(2, 0, 24)
-    SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_SHIELD, "1");
-#endif
-#if SDL_VERSION_ATLEAST(2, 0, 26)
-    SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX_360, "1");
-    SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX_360_PLAYER_LED, "1");
-    SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX_360_WIRELESS, "1");
-    SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX_ONE, "1");
-    SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX_ONE_HOME_LED, "1");
-    SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_WII_PLAYER_LED, "1");
-#endif
-
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_JOYSTICK | SDL_INIT_GAMECONTROLLER)
-        < 0) {
-      emit({Napi::String::New(env, "error"),
-            Napi::String::New(env, SDL_GetError())});
-    } else {
-      SDL_version compiled;
-      SDL_version linked;
-
-      SDL_VERSION(&compiled);
-      SDL_GetVersion(&linked);
-
-      auto info = Napi::Object::New(env);
-      std::string compile_info = std::to_string(compiled.major) + "."
-                                 + std::to_string(compiled.minor) + "."
-                                 + std::to_string(compiled.patch);
-      info.Set("compiled_against_SDL_version", compile_info);
-      std::string link_info = std::to_string(linked.major) + "."
-                              + std::to_string(linked.minor) + "."
-                              + std::to_string(linked.patch);
-      info.Set("linked_against_SDL_version", link_info);
-#if SDL_VERSION_ATLEAST(2, 0, 22)
-      if (this->hints.count("sdl_joystick_rog_chakram") > 0) {
-        info.Set("using_hints", "sdl_joystick_rog_chakram");
-      }
+    case SDL_JOYBATTERYUPDATED:
+      type = RING_BATTERY_UPDATE;
+      which = event.jbattery.which;
+      value = event.jbattery.level;
+      break;
 #endif
-      emit({Napi::String::New(env, "sdl-init"), info});
-      SdlGameController::sdlInit = true;
-
-      for (auto i = 0; i < SDL_NumJoysticks(); ++i) {
-        if (SDL_IsGameController(i)) {
-          auto obj = Napi::Object::New(env);
-          auto gc = AddController(i, &obj);
-          if (gc) {
-            obj.Set("operation", "SDL_Init");
-            emit({Napi::String::New(env, "controller-device-added"), obj});
-          } else {
-            obj.Set("message", SDL_GetError());
-            obj.Set("operation", "SDL_GameControllerOpen");
-            emit({Napi::String::New(env, "error"), obj});
-          }
-        }
-      }
-    }
+    default:
+      return false;
   }
 
-  // Ignore non-game controller events -- Does this help performance?
-  // SDL_FlushEvents(SDL_APP_TERMINATING, SDL_CONTROLLERAXISMOTION - 1);
-  // SDL_FlushEvents(SDL_DOLLARGESTURE, SDL_SENSORUPDATE - 1);
-  // SDL_FlushEvents(SDL_RENDER_TARGETS_RESET, SDL_LASTEVENT);
-
-  // poll until all events are handled!
-  SDL_Event event;
-  while (SDL_PollEvent(&event)) {
-    auto obj = Napi::Object::New(env);
+  auto head = RingWord(&ringData[RING_HEAD]);
+  auto tail = RingWord(&ringData[RING_TAIL]);
+  int32_t index = head->load(std::memory_order_relaxed);
+  int32_t next = (index + 1) % ringCapacity;
+  if (next == tail->load(std::memory_order_acquire)) {
+    // The reader is behind, count the record as dropped
+    RingWord(&ringData[RING_DROPPED])->fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
 
-    // only collect events for a "while". If we take too long just quit.
-    auto now = std::chrono::system_clock::now();
-    auto msSofar =
-      std::chrono::duration_cast<std::chrono::milliseconds>(now - start)
-        .count();
-    if (poll_number > 1 && msSofar > 100) {
-      obj.Set("message", "Polling is taking too long.");
-      obj.Set("elapsed_ms", msSofar);
-      obj.Set("poll_number", poll_number);
-      emit({Napi::String::New(env, "warning"), obj});
-      break;
-    }
+  int32_t *record = ringData + RING_HEADER_WORDS + index * RING_RECORD_WORDS;
+  record[0] = type;
+  record[1] = which;
+  record[2] = PlayerForInstance(which);
+  record[3] = code;
+  record[4] = value;
+  record[5] = static_cast<int32_t>(event.common.timestamp);
+  SDL_memcpy(&record[6], data, sizeof(data));
+  record[9] = 0;
+
+  head->store(next, std::memory_order_release);
+  return true;
+}
 
-    SDL_GameController *gc;
-    std::string gcBtn;
+int SdlGameController::PlayerForInstance(const SDL_JoystickID which) {
+  auto record = controllers.Find(which);
+  return record ? record->player : -1;
+}
 
+void SdlGameController::HandleEvent(Napi::Env env, EventSink *sink,
+                                    const SDL_Event &event) {
+  // Ring buffer readers get a fixed size record instead of an object. Device
+  // events are emitted as well because they change which controllers we have.
+  if (ringData != nullptr) {
     switch (event.type) {
       case SDL_CONTROLLERDEVICEADDED:
-        gc = AddController(event.cdevice.which, &obj);
-        if (gc) {
-          auto msg = obj.Get("message");
-          // do not emit the message if the controller was previously found
-          if (msg.IsString()) {
-            obj.Set("operation", "SDL_PollEvent");
-            emit({Napi::String::New(env, "controller-device-added"), obj});
-          }
-        } else {
-          obj.Set("message", SDL_GetError());
-          obj.Set("operation", "SDL_GameControllerOpen");
-          emit({Napi::String::New(env, "error"), obj});
-        }
-        break;
       case SDL_CONTROLLERDEVICEREMOVED:
-        obj.Set("message", "An opened Game controller has been removed");
-        obj.Set("which", static_cast<int>(event.cdevice.which));
-        RemoveController(static_cast<int>(event.cdevice.which));
-        emit({Napi::String::New(env, "controller-device-removed"), obj});
+      case SDL_CONTROLLERDEVICEREMAPPED:
         break;
+      default:
+        if (WriteRing(event))
+          return;
+    }
+  }
 
-      case SDL_CONTROLLERAXISMOTION:
-        obj.Set("message", "Game controller axis motion");
-        gcBtn = SDL_GameControllerGetStringForAxis(
-          static_cast<SDL_GameControllerAxis>(event.jaxis.axis));
-        obj.Set("button", gcBtn);
-        obj.Set("timestamp", event.jaxis.timestamp);
-        obj.Set("value", event.jaxis.value);
-
-#if SDL_VERSION_ATLEAST(2, 0, 12)
-        gc = gamecontrollers[event.jaxis.which];
-        if (gc) {
-          auto player = SDL_GameControllerGetPlayerIndex(gc);
-          obj.Set("player", player);
-        }
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  // Streamed sensor samples are sent together at the end of the poll
+  if (sensorStream && event.type == SDL_CONTROLLERSENSORUPDATE) {
+    if (Wanted(EVENT_SENSOR_BATCH))
+      StreamSensor(event);
+    return;
+  }
 #endif
 
-        emit({Napi::String::New(env, gcBtn), obj});
-        emit({Napi::String::New(env, "controller-axis-motion"), obj});
-        break;
-      case SDL_CONTROLLERBUTTONDOWN:
-        obj.Set("message", "Game controller button pressed");
-        gcBtn = SDL_GameControllerGetStringForButton(
-          static_cast<SDL_GameControllerButton>(event.cbutton.button));
-        obj.Set("button", gcBtn);
-        obj.Set("pressed", true);
+  // Nobody is listening, do not bother building the event
+  if (!Subscribed(event)) {
+    stats.unsubscribed++;
+    return;
+  }
 
-#if SDL_VERSION_ATLEAST(2, 0, 12)
-        gc = gamecontrollers[event.cbutton.which];
-        if (gc) {
-          auto player = SDL_GameControllerGetPlayerIndex(gc);
-          obj.Set("player", player);
+  auto obj = Napi::Object::New(env);
+  SDL_GameController *gc;
+  int axis;
+  int player;
+
+  switch (event.type) {
+    case SDL_CONTROLLERDEVICEADDED:
+      gc = AddController(event.cdevice.which, &obj);
+      if (gc && ringData != nullptr)
+        WriteRing(event);
+      if (gc) {
+        auto msg = obj.Get(Key(KEY_MESSAGE));
+        // do not emit the message if the controller was previously found
+        if (msg.IsString()) {
+          obj.Set(Key(KEY_OPERATION), "SDL_PollEvent");
+          Emit(sink, EVENT_CONTROLLER_DEVICE_ADDED, obj);
         }
-#endif
+      } else {
+        obj.Set(Key(KEY_MESSAGE), SDL_GetError());
+        obj.Set(Key(KEY_OPERATION), "SDL_GameControllerOpen");
+        Emit(sink, EVENT_ERROR, obj);
+      }
+      break;
+    case SDL_CONTROLLERDEVICEREMOVED:
+      obj.Set(Key(KEY_MESSAGE), "An opened Game controller has been removed");
+      obj.Set(Key(KEY_WHICH), static_cast<int>(event.cdevice.which));
+      if (ringData != nullptr)
+        WriteRing(event);
+      RemoveController(static_cast<int>(event.cdevice.which));
+      Emit(sink, EVENT_CONTROLLER_DEVICE_REMOVED, obj);
+      break;
 
-        emit({Napi::String::New(env, gcBtn + ":down"), obj});
-        emit({Napi::String::New(env, gcBtn), obj});
-        emit({Napi::String::New(env, "controller-button-down"), obj});
+    case SDL_CONTROLLERAXISMOTION:
+      axis = event.caxis.axis;
+      if (axis >= SDL_CONTROLLER_AXIS_MAX)
         break;
-      case SDL_CONTROLLERBUTTONUP:
-        obj.Set("message", "Game controller button released");
-        gcBtn = SDL_GameControllerGetStringForButton(
-          static_cast<SDL_GameControllerButton>(event.cbutton.button));
-        obj.Set("button", gcBtn);
-        obj.Set("pressed", false);
+      obj.Set(Key(KEY_MESSAGE), Key(KEY_AXIS_MOTION_MESSAGE));
+      obj.Set(Key(KEY_BUTTON), EventName(EVENT_AXIS_FIRST + axis));
+      obj.Set(Key(KEY_TIMESTAMP), event.caxis.timestamp);
+      obj.Set(Key(KEY_VALUE), event.caxis.value);
 
-#if SDL_VERSION_ATLEAST(2, 0, 12)
-        gc = gamecontrollers[event.cbutton.which];
-        if (gc) {
-          auto player = SDL_GameControllerGetPlayerIndex(gc);
-          obj.Set("player", player);
-        }
-#endif
+      player = PlayerForInstance(event.caxis.which);
+      if (player >= 0)
+        obj.Set(Key(KEY_PLAYER), player);
 
-        emit({Napi::String::New(env, gcBtn + ":up"), obj});
-        emit({Napi::String::New(env, gcBtn), obj});
-        emit({Napi::String::New(env, "controller-button-up"), obj});
-        break;
+      EmitAlias(sink, EVENT_AXIS_FIRST + axis, obj);
+      Emit(sink, EVENT_CONTROLLER_AXIS_MOTION, obj);
+      break;
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+      HandleButton(sink, &obj, event.cbutton.button,
+                   event.type == SDL_CONTROLLERBUTTONDOWN,
+                   PlayerForInstance(event.cbutton.which));
+      break;
 
-      case SDL_CONTROLLERDEVICEREMAPPED:
-        obj.Set("message", "The controller mapping was updated");
-        obj.Set("which", static_cast<int>(event.cdevice.which));
-        emit({Napi::String::New(env, "controller-device-remapped"), obj});
-        break;
+    case SDL_CONTROLLERDEVICEREMAPPED:
+      obj.Set(Key(KEY_MESSAGE), "The controller mapping was updated");
+      obj.Set(Key(KEY_WHICH), static_cast<int>(event.cdevice.which));
+      if (ringData != nullptr)
+        WriteRing(event);
+      Emit(sink, EVENT_CONTROLLER_DEVICE_REMAPPED, obj);
+      break;
 
 #if SDL_VERSION_ATLEAST(2, 0, 14)
-      case SDL_CONTROLLERTOUCHPADDOWN:
-        obj.Set("message", "Game controller touchpad was touched");
-        obj.Set("touchpad", event.ctouchpad.touchpad);
-        obj.Set("finger", event.ctouchpad.finger);
-        obj.Set("x", event.ctouchpad.x);
-        obj.Set("y", event.ctouchpad.y);
-        obj.Set("pressure", event.ctouchpad.pressure);
-        emit({Napi::String::New(env, "controller-touchpad-down"), obj});
-        break;
-      case SDL_CONTROLLERTOUCHPADMOTION:
-        obj.Set("message", "Game controller touchpad finger was moved");
-        obj.Set("touchpad", event.ctouchpad.touchpad);
-        obj.Set("finger", event.ctouchpad.finger);
-        obj.Set("x", event.ctouchpad.x);
-        obj.Set("y", event.ctouchpad.y);
-        obj.Set("pressure", event.ctouchpad.pressure);
-        emit({Napi::String::New(env, "controller-touchpad-motion"), obj});
-        break;
-      case SDL_CONTROLLERTOUCHPADUP:
-        obj.Set("message", "Game controller touchpad finger was lifted");
-        obj.Set("touchpad", event.ctouchpad.touchpad);
-        obj.Set("finger", event.ctouchpad.finger);
-        obj.Set("x", event.ctouchpad.x);
-        obj.Set("y", event.ctouchpad.y);
-        obj.Set("pressure", event.ctouchpad.pressure);
-        emit({Napi::String::New(env, "controller-touchpad-up"), obj});
-        break;
+    case SDL_CONTROLLERTOUCHPADDOWN:
+      obj.Set(Key(KEY_MESSAGE), Key(KEY_TOUCHPAD_DOWN_MESSAGE));
+      SetTouchpadFields(&obj, event);
+      Emit(sink, EVENT_CONTROLLER_TOUCHPAD_DOWN, obj);
+      break;
+    case SDL_CONTROLLERTOUCHPADMOTION:
+      obj.Set(Key(KEY_MESSAGE), Key(KEY_TOUCHPAD_MOTION_MESSAGE));
+      SetTouchpadFields(&obj, event);
+      Emit(sink, EVENT_CONTROLLER_TOUCHPAD_MOTION, obj);
+      break;
+    case SDL_CONTROLLERTOUCHPADUP:
+      obj.Set(Key(KEY_MESSAGE), Key(KEY_TOUCHPAD_UP_MESSAGE));
+      SetTouchpadFields(&obj, event);
+      Emit(sink, EVENT_CONTROLLER_TOUCHPAD_UP, obj);
+      break;
 
-      case SDL_CONTROLLERSENSORUPDATE:
-        obj.Set("message", "Game controller sensor was updated");
-        switch (event.csensor.sensor) {
-          case SDL_SENSOR_GYRO:
-            obj.Set("sensor", "gyroscope");
-            obj.Set("x", event.csensor.data[0]);
-            obj.Set("y", event.csensor.data[1]);
-            obj.Set("z", event.csensor.data[2]);
-            emit({Napi::String::New(env, "gyroscope"), obj});
-            break;
-          case SDL_SENSOR_ACCEL:
-            obj.Set("sensor", "accelerometer");
-            obj.Set("x", event.csensor.data[0]);
-            obj.Set("y", event.csensor.data[1]);
-            obj.Set("z", event.csensor.data[2]);
-            emit({Napi::String::New(env, "accelerometer"), obj});
-            break;
-          default:
-            obj.Set("sensor", "unknown");
-            obj.Set("x", event.csensor.data[0]);
-            obj.Set("y", event.csensor.data[1]);
-            obj.Set("z", event.csensor.data[2]);
-            break;
-        }
-        emit({Napi::String::New(env, "controller-sensor-update"), obj});
-        break;
+    case SDL_CONTROLLERSENSORUPDATE:
+      obj.Set(Key(KEY_MESSAGE), Key(KEY_SENSOR_MESSAGE));
+      switch (event.csensor.sensor) {
+        case SDL_SENSOR_GYRO:
+          obj.Set(Key(KEY_SENSOR), EventName(EVENT_GYROSCOPE));
+          break;
+        case SDL_SENSOR_ACCEL:
+          obj.Set(Key(KEY_SENSOR), EventName(EVENT_ACCELEROMETER));
+          break;
+        default:
+          obj.Set(Key(KEY_SENSOR), "unknown");
+          break;
+      }
+      obj.Set(Key(KEY_X), event.csensor.data[0]);
+      obj.Set(Key(KEY_Y), event.csensor.data[1]);
+      obj.Set(Key(KEY_Z), event.csensor.data[2]);
+      if (event.csensor.sensor == SDL_SENSOR_GYRO)
+        EmitAlias(sink, EVENT_GYROSCOPE, obj);
+      else if (event.csensor.sensor == SDL_SENSOR_ACCEL)
+        EmitAlias(sink, EVENT_ACCELEROMETER, obj);
+      Emit(sink, EVENT_CONTROLLER_SENSOR_UPDATE, obj);
+      break;
 #endif
 #if SDL_VERSION_ATLEAST(2, 0, 24)
-      case SDL_JOYBATTERYUPDATED:
-        obj.Set("message", "Game controller battery was updated");
-        obj.Set("timestamp", event.jbattery.timestamp);
-        obj.Set("which", static_cast<int>(event.jbattery.which));
-        switch (event.jbattery.level) {
-          case SDL_JOYSTICK_POWER_EMPTY:
-            obj.Set("level", "empty");
-            break;
-          case SDL_JOYSTICK_POWER_LOW:
-            obj.Set("level", "low");
-            break;
-          case SDL_JOYSTICK_POWER_MEDIUM:
-            obj.Set("level", "medium");
-            break;
-          case SDL_JOYSTICK_POWER_FULL:
-            obj.Set("level", "full");
-            break;
-          case SDL_JOYSTICK_POWER_WIRED:
-            obj.Set("level", "wired");
-            break;
-          case SDL_JOYSTICK_POWER_MAX:
-            obj.Set("level", "max");
-            break;
-          default:
-            obj.Set("level", "unknown");
-        }
-        emit({Napi::String::New(env, "controller-battery-update"), obj});
-        break;
+    case SDL_JOYBATTERYUPDATED:
+      obj.Set(Key(KEY_MESSAGE), "Game controller battery was updated");
+      obj.Set(Key(KEY_TIMESTAMP), event.jbattery.timestamp);
+      obj.Set(Key(KEY_WHICH), static_cast<int>(event.jbattery.which));
+      switch (event.jbattery.level) {
+        case SDL_JOYSTICK_POWER_EMPTY:
+          obj.Set(Key(KEY_LEVEL), "empty");
+          break;
+        case SDL_JOYSTICK_POWER_LOW:
+          obj.Set(Key(KEY_LEVEL), "low");
+          break;
+        case SDL_JOYSTICK_POWER_MEDIUM:
+          obj.Set(Key(KEY_LEVEL), "medium");
+          break;
+        case SDL_JOYSTICK_POWER_FULL:
+          obj.Set(Key(KEY_LEVEL), "full");
+          break;
+        case SDL_JOYSTICK_POWER_WIRED:
+          obj.Set(Key(KEY_LEVEL), "wired");
+          break;
+        case SDL_JOYSTICK_POWER_MAX:
+          obj.Set(Key(KEY_LEVEL), "max");
+          break;
+        default:
+          obj.Set(Key(KEY_LEVEL), "unknown");
+      }
+      Emit(sink, EVENT_CONTROLLER_BATTERY_UPDATE, obj);
+      break;
 #endif
-        // LIMITED support for keyboard events - probably only helpful for
-        // testing
-      case SDL_KEYDOWN:
-      case SDL_KEYUP:
-        if (event.key.keysym.scancode == SDL_SCANCODE_A
-            || event.key.keysym.scancode == SDL_SCANCODE_B
-            || event.key.keysym.scancode == SDL_SCANCODE_X
-            || event.key.keysym.scancode == SDL_SCANCODE_Y) {
-          if (event.key.state == SDL_PRESSED) {
-            obj.Set("message", "Game controller button pressed");
-            gcBtn =
-              SDL_GetKeyName(SDL_GetKeyFromScancode(event.key.keysym.scancode));
-            gcBtn[0] = std::tolower(gcBtn[0]);
-            obj.Set("button", gcBtn);
-            obj.Set("pressed", true);
-            emit({Napi::String::New(env, gcBtn + ":down"), obj});
-            emit({Napi::String::New(env, gcBtn), obj});
-            emit({Napi::String::New(env, "controller-button-down"), obj});
-          } else {
-            obj.Set("message", "Game controller button released");
-            gcBtn =
-              SDL_GetKeyName(SDL_GetKeyFromScancode(event.key.keysym.scancode));
-            gcBtn[0] = std::tolower(gcBtn[0]);
-            obj.Set("button", gcBtn);
-            obj.Set("pressed", false);
-            emit({Napi::String::New(env, gcBtn + ":up"), obj});
-            emit({Napi::String::New(env, gcBtn), obj});
-            emit({Napi::String::New(env, "controller-button-up"), obj});
-          }
-        }
-    }
+      // LIMITED support for keyboard events - probably only helpful for
+      // testing
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      switch (event.key.keysym.scancode) {
+        case SDL_SCANCODE_A:
+          HandleButton(sink, &obj, SDL_CONTROLLER_BUTTON_A,
+                       event.key.state == SDL_PRESSED, -1);
+          break;
+        case SDL_SCANCODE_B:
+          HandleButton(sink, &obj, SDL_CONTROLLER_BUTTON_B,
+                       event.key.state == SDL_PRESSED, -1);
+          break;
+        case SDL_SCANCODE_X:
+          HandleButton(sink, &obj, SDL_CONTROLLER_BUTTON_X,
+                       event.key.state == SDL_PRESSED, -1);
+          break;
+        case SDL_SCANCODE_Y:
+          HandleButton(sink, &obj, SDL_CONTROLLER_BUTTON_Y,
+                       event.key.state == SDL_PRESSED, -1);
+          break;
+        default:
+          break;
+      }
+  }
+}
+
+void SdlGameController::HandleButton(EventSink *sink, Napi::Object *obj,
+                                     int button, bool pressed, int player) {
+  if (button < 0 || button >= SDL_CONTROLLER_BUTTON_MAX)
+    return;
+
+  if (pressed)
+    obj->Set(Key(KEY_MESSAGE), Key(KEY_BUTTON_PRESSED_MESSAGE));
+  else
+    obj->Set(Key(KEY_MESSAGE), Key(KEY_BUTTON_RELEASED_MESSAGE));
+  obj->Set(Key(KEY_BUTTON), EventName(ButtonEventId(button)));
+  obj->Set(Key(KEY_PRESSED), pressed);
+  if (player >= 0)
+    obj->Set(Key(KEY_PLAYER), player);
+
+  if (pressed) {
+    EmitAlias(sink, ButtonEventId(button, BUTTON_ALIAS_DOWN), *obj);
+    EmitAlias(sink, ButtonEventId(button), *obj);
+    Emit(sink, EVENT_CONTROLLER_BUTTON_DOWN, *obj);
+  } else {
+    EmitAlias(sink, ButtonEventId(button, BUTTON_ALIAS_UP), *obj);
+    EmitAlias(sink, ButtonEventId(button), *obj);
+    Emit(sink, EVENT_CONTROLLER_BUTTON_UP, *obj);
   }
+}
 
-  return Napi::String::New(env, "OK");
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+void SdlGameController::SetTouchpadFields(Napi::Object *obj,
+                                          const SDL_Event &event) {
+  obj->Set(Key(KEY_TOUCHPAD), event.ctouchpad.touchpad);
+  obj->Set(Key(KEY_FINGER), event.ctouchpad.finger);
+  obj->Set(Key(KEY_X), event.ctouchpad.x);
+  obj->Set(Key(KEY_Y), event.ctouchpad.y);
+  obj->Set(Key(KEY_PRESSURE), event.ctouchpad.pressure);
 }
+#endif
 
 void SdlGameController::enableGyroscope(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
-  Napi::Function emit_unbound =
-    info.This().As<Napi::Object>().Get("emit").As<Napi::Function>();
-  Napi::Function emit = emit_unbound.Get("bind")
-                          .As<Napi::Function>()
-                          .Call(emit_unbound, {info.This()})
-                          .As<Napi::Function>();
+  Napi::Function emit = Emitter(info);
 
   SDL_bool enable = SDL_TRUE;
   int playerNumber = 0;  // enable for all players
@@ -541,7 +2444,7 @@ void SdlGameController::enableGyroscope(const Napi::CallbackInfo &info) {
       enable = info[0].ToBoolean() ? SDL_TRUE : SDL_FALSE;
     } else {
       warning.Set("message", "wrong argument type: enable");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -551,36 +2454,42 @@ void SdlGameController::enableGyroscope(const Napi::CallbackInfo &info) {
       playerNumber = info[1].ToNumber();
     } else {
       warning.Set("message", "wrong argument type: player");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
-  for (auto &controller : gamecontrollers) {
+  for (auto &controller : controllers) {
     auto obj = Napi::Object::New(env);
 #if SDL_VERSION_ATLEAST(2, 0, 12)
-    auto player = SDL_GameControllerGetPlayerIndex(controller.second);
-    obj.Set("player", player);
+    auto player = controller.player;
+    obj.Set(Key(KEY_PLAYER), player);
 #else
     auto player = playerNumber;
 #endif
     if (playerNumber == 0 || playerNumber == player) {
 #if SDL_VERSION_ATLEAST(2, 0, 14)
-      auto success = SDL_GameControllerSetSensorEnabled(controller.second,
-                                                        SDL_SENSOR_GYRO, enable)
-                     == 0;
+      auto success = false;
+      if (controller.Lacks(CAP_GYROSCOPE))
+        SDL_Unsupported();
+      else if (SDL_GameControllerSetSensorEnabled(controller.controller,
+                                                  SDL_SENSOR_GYRO, enable)
+               == 0)
+        success = true;
 #else
       (void) controller;
       auto success = false;
 #endif
       if (success) {
+        controller.gyroscope = enable;
+        controller.outputs++;
         if (enable)
-          emit({Napi::String::New(env, "gyroscope:enabled"), obj});
+          emit({EventName(EVENT_GYROSCOPE_ENABLED), obj});
         else
-          emit({Napi::String::New(env, "gyroscope:disabled"), obj});
+          emit({EventName(EVENT_GYROSCOPE_DISABLED), obj});
       } else {
         obj.Set("message", SDL_GetError());
         obj.Set("operation", "enableGyroscope");
-        emit({Napi::String::New(env, "error"), obj});
+        emit({EventName(EVENT_ERROR), obj});
       }
     }
   }
@@ -588,12 +2497,7 @@ void SdlGameController::enableGyroscope(const Napi::CallbackInfo &info) {
 
 void SdlGameController::enableAccelerometer(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
-  Napi::Function emit_unbound =
-    info.This().As<Napi::Object>().Get("emit").As<Napi::Function>();
-  Napi::Function emit = emit_unbound.Get("bind")
-                          .As<Napi::Function>()
-                          .Call(emit_unbound, {info.This()})
-                          .As<Napi::Function>();
+  Napi::Function emit = Emitter(info);
 
   int playerNumber = 0;  // enable for all players
   SDL_bool enable = SDL_TRUE;
@@ -605,7 +2509,7 @@ void SdlGameController::enableAccelerometer(const Napi::CallbackInfo &info) {
       enable = info[0].ToBoolean() ? SDL_TRUE : SDL_FALSE;
     } else {
       warning.Set("message", "wrong argument type: enable");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -614,37 +2518,42 @@ void SdlGameController::enableAccelerometer(const Napi::CallbackInfo &info) {
       playerNumber = info[1].ToNumber();
     } else {
       warning.Set("message", "wrong argument type: player");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
-  for (auto &controller : gamecontrollers) {
+  for (auto &controller : controllers) {
 #if SDL_VERSION_ATLEAST(2, 0, 12)
-    auto player = SDL_GameControllerGetPlayerIndex(controller.second);
+    auto player = controller.player;
 #else
     auto player = playerNumber;
 #endif
     if (playerNumber == 0 || playerNumber == player) {
       auto obj = Napi::Object::New(env);
-      obj.Set("player", player);
+      obj.Set(Key(KEY_PLAYER), player);
 #if SDL_VERSION_ATLEAST(2, 0, 14)
-      auto success =
-        SDL_GameControllerSetSensorEnabled(controller.second, SDL_SENSOR_ACCEL,
-                                           enable)
-        == 0;
+      auto success = false;
+      if (controller.Lacks(CAP_ACCELEROMETER))
+        SDL_Unsupported();
+      else if (SDL_GameControllerSetSensorEnabled(controller.controller,
+                                                  SDL_SENSOR_ACCEL, enable)
+               == 0)
+        success = true;
 #else
       (void) controller;
       auto success = false;
 #endif
       if (success) {
+        controller.accelerometer = enable;
+        controller.outputs++;
         if (enable)
-          emit({Napi::String::New(env, "accelerometer:enabled"), obj});
+          emit({EventName(EVENT_ACCELEROMETER_ENABLED), obj});
         else
-          emit({Napi::String::New(env, "accelerometer:disabled"), obj});
+          emit({EventName(EVENT_ACCELEROMETER_DISABLED), obj});
       } else {
         obj.Set("message", SDL_GetError());
         obj.Set("operation", "enableAccelerometer");
-        emit({Napi::String::New(env, "error"), obj});
+        emit({EventName(EVENT_ERROR), obj});
       }
     }
   }
@@ -652,12 +2561,7 @@ void SdlGameController::enableAccelerometer(const Napi::CallbackInfo &info) {
 
 void SdlGameController::rumble(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
-  Napi::Function emit_unbound =
-    info.This().As<Napi::Object>().Get("emit").As<Napi::Function>();
-  Napi::Function emit = emit_unbound.Get("bind")
-                          .As<Napi::Function>()
-                          .Call(emit_unbound, {info.This()})
-                          .As<Napi::Function>();
+  Napi::Function emit = Emitter(info);
 
   int playerNumber = 0;  // rumble all players
   Uint16 low_frequency_rumble = 0xFFFC;
@@ -671,7 +2575,7 @@ void SdlGameController::rumble(const Napi::CallbackInfo &info) {
       low_frequency_rumble = static_cast<uint32_t>(info[0].ToNumber());
     } else {
       warning.Set("message", "wrong argument type: low_frequency_rumble");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -681,7 +2585,7 @@ void SdlGameController::rumble(const Napi::CallbackInfo &info) {
       high_frequency_rumble = static_cast<uint32_t>(info[1].ToNumber());
     } else {
       warning.Set("message", "wrong argument type: high_frequency_rumble");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -691,7 +2595,7 @@ void SdlGameController::rumble(const Napi::CallbackInfo &info) {
       duration_ms = static_cast<uint32_t>(info[2].ToNumber());
     } else {
       warning.Set("message", "wrong argument type: duration_ms");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -701,23 +2605,27 @@ void SdlGameController::rumble(const Napi::CallbackInfo &info) {
       playerNumber = info[3].ToNumber();
     } else {
       warning.Set("message", "wrong argument type: player");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
-  for (auto &controller : gamecontrollers) {
+  for (auto &controller : controllers) {
 #if SDL_VERSION_ATLEAST(2, 0, 12)
-    auto player = SDL_GameControllerGetPlayerIndex(controller.second);
+    auto player = controller.player;
 #else
     auto player = playerNumber;
 #endif
     if (playerNumber == 0 || playerNumber == player) {
       auto obj = Napi::Object::New(env);
-      obj.Set("player", player);
+      obj.Set(Key(KEY_PLAYER), player);
 #if SDL_VERSION_ATLEAST(2, 0, 10)
-      auto success =
-        SDL_GameControllerRumble(controller.second, low_frequency_rumble,
-                                 high_frequency_rumble, duration_ms);
+      int success = -1;
+      if (controller.Lacks(CAP_RUMBLE))
+        SDL_Unsupported();
+      else
+        success =
+          SDL_GameControllerRumble(controller.controller, low_frequency_rumble,
+                                   high_frequency_rumble, duration_ms);
 #else
       (void) controller;
       (void) low_frequency_rumble;
@@ -726,11 +2634,16 @@ void SdlGameController::rumble(const Napi::CallbackInfo &info) {
       int success = -1;
 #endif
       if (success >= 0) {
-        emit({Napi::String::New(env, "rumbled"), obj});
+        controller.rumbleLow = low_frequency_rumble;
+        controller.rumbleHigh = high_frequency_rumble;
+        controller.rumbleExpires =
+          duration_ms ? SDL_GetTicks() + duration_ms : 0;
+        controller.outputs++;
+        emit({EventName(EVENT_RUMBLED), obj});
       } else {
         obj.Set("message", SDL_GetError());
         obj.Set("operation", "rumble");
-        emit({Napi::String::New(env, "error"), obj});
+        emit({EventName(EVENT_ERROR), obj});
       }
     }
   }
@@ -738,12 +2651,7 @@ void SdlGameController::rumble(const Napi::CallbackInfo &info) {
 
 void SdlGameController::rumbleTriggers(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
-  Napi::Function emit_unbound =
-    info.This().As<Napi::Object>().Get("emit").As<Napi::Function>();
-  Napi::Function emit = emit_unbound.Get("bind")
-                          .As<Napi::Function>()
-                          .Call(emit_unbound, {info.This()})
-                          .As<Napi::Function>();
+  Napi::Function emit = Emitter(info);
 
   int playerNumber = 0;  // rumble all players
   Uint16 left_rumble = 0xFFFC;
@@ -757,7 +2665,7 @@ void SdlGameController::rumbleTriggers(const Napi::CallbackInfo &info) {
       left_rumble = static_cast<uint32_t>(info[0].ToNumber());
     } else {
       warning.Set("message", "wrong argument type: left_rumble");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -767,7 +2675,7 @@ void SdlGameController::rumbleTriggers(const Napi::CallbackInfo &info) {
       right_rumble = static_cast<uint32_t>(info[1].ToNumber());
     } else {
       warning.Set("message", "wrong argument type: right_rumble");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -777,7 +2685,7 @@ void SdlGameController::rumbleTriggers(const Napi::CallbackInfo &info) {
       duration_ms = static_cast<uint32_t>(info[2].ToNumber());
     } else {
       warning.Set("message", "wrong argument type: duration_ms");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -788,23 +2696,26 @@ void SdlGameController::rumbleTriggers(const Napi::CallbackInfo &info) {
       playerNumber = info[3].ToNumber();
     } else {
       warning.Set("message", "wrong argument type: player");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
-  for (auto &controller : gamecontrollers) {
+  for (auto &controller : controllers) {
 #if SDL_VERSION_ATLEAST(2, 0, 12)
-    auto player = SDL_GameControllerGetPlayerIndex(controller.second);
+    auto player = controller.player;
 #else
     auto player = playerNumber;
 #endif
     if (playerNumber == 0 || playerNumber == player) {
       auto obj = Napi::Object::New(env);
-      obj.Set("player", player);
+      obj.Set(Key(KEY_PLAYER), player);
 #if SDL_VERSION_ATLEAST(2, 0, 14)
-      auto code =
-        SDL_GameControllerRumbleTriggers(controller.second, left_rumble,
-                                         right_rumble, duration_ms);
+      int code = -1;
+      if (controller.Lacks(CAP_RUMBLE_TRIGGERS))
+        SDL_Unsupported();
+      else
+        code = SDL_GameControllerRumbleTriggers(
+          controller.controller, left_rumble, right_rumble, duration_ms);
 #else
       (void) controller;
       (void) left_rumble;
@@ -813,11 +2724,16 @@ void SdlGameController::rumbleTriggers(const Napi::CallbackInfo &info) {
       int code = -1;
 #endif
       if (code >= 0) {
-        emit({Napi::String::New(env, "rumbled-triggers"), obj});
+        controller.triggerLeft = left_rumble;
+        controller.triggerRight = right_rumble;
+        controller.triggerExpires =
+          duration_ms ? SDL_GetTicks() + duration_ms : 0;
+        controller.outputs++;
+        emit({EventName(EVENT_RUMBLED_TRIGGERS), obj});
       } else {
         obj.Set("message", SDL_GetError());
         obj.Set("operation", "rumbleTriggers");
-        emit({Napi::String::New(env, "error"), obj});
+        emit({EventName(EVENT_ERROR), obj});
       }
     }
   }
@@ -825,12 +2741,7 @@ void SdlGameController::rumbleTriggers(const Napi::CallbackInfo &info) {
 
 void SdlGameController::setLeds(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
-  Napi::Function emit_unbound =
-    info.This().As<Napi::Object>().Get("emit").As<Napi::Function>();
-  Napi::Function emit = emit_unbound.Get("bind")
-                          .As<Napi::Function>()
-                          .Call(emit_unbound, {info.This()})
-                          .As<Napi::Function>();
+  Napi::Function emit = Emitter(info);
 
   int playerNumber = 0;  // set LEDs for all players
   Uint8 red = 0x00;
@@ -844,7 +2755,7 @@ void SdlGameController::setLeds(const Napi::CallbackInfo &info) {
       red = static_cast<uint32_t>(info[0].ToNumber());
     } else {
       warning.Set("message", "wrong argument type: red");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -854,7 +2765,7 @@ void SdlGameController::setLeds(const Napi::CallbackInfo &info) {
       green = static_cast<uint32_t>(info[1].ToNumber());
     } else {
       warning.Set("message", "wrong argument type: green");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -864,7 +2775,7 @@ void SdlGameController::setLeds(const Napi::CallbackInfo &info) {
       blue = static_cast<uint32_t>(info[2].ToNumber());
     } else {
       warning.Set("message", "wrong argument type: blue");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
@@ -874,21 +2785,26 @@ void SdlGameController::setLeds(const Napi::CallbackInfo &info) {
       playerNumber = info[3].ToNumber();
     } else {
       warning.Set("message", "wrong argument type: player");
-      emit({Napi::String::New(env, "warning"), warning});
+      emit({EventName(EVENT_WARNING), warning});
     }
   }
 
-  for (auto &controller : gamecontrollers) {
+  for (auto &controller : controllers) {
 #if SDL_VERSION_ATLEAST(2, 0, 12)
-    auto player = SDL_GameControllerGetPlayerIndex(controller.second);
+    auto player = controller.player;
 #else
     auto player = playerNumber;
 #endif
     if (playerNumber == 0 || playerNumber == player) {
       auto obj = Napi::Object::New(env);
-      obj.Set("player", player);
+      obj.Set(Key(KEY_PLAYER), player);
 #if SDL_VERSION_ATLEAST(2, 0, 14)
-      auto code = SDL_GameControllerSetLED(controller.second, red, green, blue);
+      int code = -1;
+      if (controller.Lacks(CAP_LED))
+        SDL_Unsupported();
+      else
+        code =
+          SDL_GameControllerSetLED(controller.controller, red, green, blue);
 #else
       (void) controller;
       (void) red;
@@ -897,12 +2813,847 @@ void SdlGameController::setLeds(const Napi::CallbackInfo &info) {
       int code = -1;
 #endif
       if (code >= 0) {
-        emit({Napi::String::New(env, "led"), obj});
+        controller.led[0] = red;
+        controller.led[1] = green;
+        controller.led[2] = blue;
+        // The next setEffects LED has to be sent again
+        controller.ds5.known &= ~DS5_LED;
+        controller.outputs++;
+        emit({EventName(EVENT_LED), obj});
       } else {
         obj.Set("message", SDL_GetError());
         obj.Set("operation", "setLeds");
-        emit({Napi::String::New(env, "error"), obj});
+        emit({EventName(EVENT_ERROR), obj});
+      }
+    }
+  }
+}
+
+// Rumble that ran out counts as off when comparing with a frame
+static bool Expired(Uint32 expires, Uint32 now) {
+  return expires != 0 && SDL_TICKS_PASSED(now, expires);
+}
+
+Napi::Value SdlGameController::applyOutputs(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+
+  if (info.Length() < 1 || !info[0].IsTypedArray()
+      || info[0].As<Napi::TypedArray>().TypedArrayType()
+           != napi_uint16_array) {
+    auto warning = Napi::Object::New(env);
+    warning.Set("message", "wrong argument type: frame must be a Uint16Array");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+  bool ack = info.Length() > 1 && info[1].ToBoolean();
+
+  auto frame = info[0].As<Napi::Uint16Array>();
+  const uint16_t *data = frame.Data();
+  size_t length = frame.ElementLength();
+  if (length < OUTPUT_HEADER_WORDS)
+    return Napi::Number::New(env, 0);
+  size_t count = data[OUTPUT_COUNT];
+  size_t stride = data[OUTPUT_STRIDE];
+  if (stride < OUTPUT_RECORD_WORDS)
+    stride = OUTPUT_RECORD_WORDS;
+
+  EventSink sink;
+  sink.emit = emit;
+  OutputResult result;
+  Uint32 now = SDL_GetTicks();
+  for (size_t i = 0; i < count; i++) {
+    size_t offset = OUTPUT_HEADER_WORDS + i * stride;
+    if (offset + OUTPUT_RECORD_WORDS > length)
+      break;
+    const uint16_t *record = data + offset;
+    for (auto &controller : controllers) {
+      if (controller.player == record[OUTPUT_PLAYER]) {
+        WantOutputs(&controller, record, now, &result);
+        WriteOutputs(env, &sink, &controller, now, &result);
+      }
+    }
+  }
+
+  if (ack) {
+    auto obj = Napi::Object::New(env);
+    obj.Set("written", result.written);
+    obj.Set("unchanged", result.unchanged);
+    obj.Set("deferred", result.deferred);
+    obj.Set("unsupported", result.unsupported);
+    obj.Set("failed", result.failed);
+    emit({EventName(EVENT_OUTPUTS_APPLIED), obj});
+  }
+  return Napi::Number::New(env, result.written);
+}
+
+void SdlGameController::WantOutputs(ControllerRecord *controller,
+                                    const uint16_t *record, Uint32 now,
+                                    OutputResult *result) {
+  uint16_t flags = record[OUTPUT_FLAGS];
+
+  if (flags & OUTPUT_RUMBLE) {
+    Uint16 low = record[OUTPUT_RUMBLE_LOW];
+    Uint16 high = record[OUTPUT_RUMBLE_HIGH];
+    bool off = Expired(controller->rumbleExpires, now);
+    if (controller->Lacks(CAP_RUMBLE)) {
+      result->unsupported++;
+    } else if (low == (off ? 0 : controller->rumbleLow)
+               && high == (off ? 0 : controller->rumbleHigh)) {
+      result->unchanged++;
+      controller->dirty &= ~OUTPUT_RUMBLE;
+    } else {
+      controller->wantRumble[0] = low;
+      controller->wantRumble[1] = high;
+      controller->dirty |= OUTPUT_RUMBLE;
+    }
+  }
+
+  if (flags & OUTPUT_TRIGGERS) {
+    Uint16 left = record[OUTPUT_TRIGGER_LEFT];
+    Uint16 right = record[OUTPUT_TRIGGER_RIGHT];
+    bool off = Expired(controller->triggerExpires, now);
+    if (controller->Lacks(CAP_RUMBLE_TRIGGERS)) {
+      result->unsupported++;
+    } else if (left == (off ? 0 : controller->triggerLeft)
+               && right == (off ? 0 : controller->triggerRight)) {
+      result->unchanged++;
+      controller->dirty &= ~OUTPUT_TRIGGERS;
+    } else {
+      controller->wantTriggers[0] = left;
+      controller->wantTriggers[1] = right;
+      controller->dirty |= OUTPUT_TRIGGERS;
+    }
+  }
+
+  if (flags & OUTPUT_LED) {
+    Uint8 led[3] = {static_cast<Uint8>(record[OUTPUT_RED]),
+                    static_cast<Uint8>(record[OUTPUT_GREEN]),
+                    static_cast<Uint8>(record[OUTPUT_BLUE])};
+    if (controller->Lacks(CAP_LED)) {
+      result->unsupported++;
+    } else if (SDL_memcmp(led, controller->led, sizeof(led)) == 0) {
+      result->unchanged++;
+      controller->dirty &= ~OUTPUT_LED;
+    } else {
+      SDL_memcpy(controller->wantLed, led, sizeof(led));
+      controller->dirty |= OUTPUT_LED;
+    }
+  }
+}
+
+void SdlGameController::WriteOutputs(Napi::Env env, EventSink *sink,
+                                     ControllerRecord *controller, Uint32 now,
+                                     OutputResult *result) {
+  if (controller->dirty == 0)
+    return;
+  // Writing faster than the device reads its reports only queues them up
+  if (outputInterval > 0 && controller->lastWrite != 0
+      && !SDL_TICKS_PASSED(now, controller->lastWrite + outputInterval)) {
+    result->deferred++;
+    return;
+  }
+
+  // A failed write stays dirty, so the next flush tries it again even when
+  // the frames ask for the same state. The error is reported once.
+  uint32_t retry = 0;
+  auto failed = [&](uint32_t output, const char *operation) {
+    retry |= output;
+    result->failed++;
+    if (controller->failing & output)
+      return;
+    controller->failing |= output;
+    auto obj = Napi::Object::New(env);
+    obj.Set(Key(KEY_MESSAGE), SDL_GetError());
+    obj.Set(Key(KEY_OPERATION), operation);
+    obj.Set(Key(KEY_PLAYER), controller->player);
+    Emit(sink, EVENT_ERROR, obj);
+  };
+
+#if SDL_VERSION_ATLEAST(2, 0, 10)
+  if (controller->dirty & OUTPUT_RUMBLE) {
+    // Duration 0 keeps it going until the next change
+    if (SDL_GameControllerRumble(controller->controller,
+                                 controller->wantRumble[0],
+                                 controller->wantRumble[1], 0)
+        == 0) {
+      result->written++;
+      controller->rumbleLow = controller->wantRumble[0];
+      controller->rumbleHigh = controller->wantRumble[1];
+      controller->rumbleExpires = 0;
+    } else {
+      failed(OUTPUT_RUMBLE, "applyOutputs rumble");
+    }
+  }
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 14)
+  if (controller->dirty & OUTPUT_TRIGGERS) {
+    if (SDL_GameControllerRumbleTriggers(controller->controller,
+                                         controller->wantTriggers[0],
+                                         controller->wantTriggers[1], 0)
+        == 0) {
+      result->written++;
+      controller->triggerLeft = controller->wantTriggers[0];
+      controller->triggerRight = controller->wantTriggers[1];
+      controller->triggerExpires = 0;
+    } else {
+      failed(OUTPUT_TRIGGERS, "applyOutputs rumbleTriggers");
+    }
+  }
+
+  if (controller->dirty & OUTPUT_LED) {
+    if (SDL_GameControllerSetLED(controller->controller,
+                                 controller->wantLed[0],
+                                 controller->wantLed[1],
+                                 controller->wantLed[2])
+        == 0) {
+      result->written++;
+      SDL_memcpy(controller->led, controller->wantLed,
+                 sizeof(controller->led));
+      controller->ds5.known &= ~DS5_LED;
+    } else {
+      failed(OUTPUT_LED, "applyOutputs setLeds");
+    }
+  }
+#endif
+
+  controller->failing &= retry;
+  controller->dirty = retry;
+  controller->lastWrite = now;
+  controller->outputs++;
+}
+
+void SdlGameController::FlushOutputs(Napi::Env env, EventSink *sink) {
+  OutputResult result;
+  Uint32 now = 0;
+  for (auto &controller : controllers) {
+    if (controller.dirty == 0)
+      continue;
+    if (now == 0)
+      now = SDL_GetTicks();
+    WriteOutputs(env, sink, &controller, now, &result);
+  }
+}
+
+static Uint16 KeyframeValue(Napi::Object keyframe, const char *name) {
+  Napi::Value value = keyframe.Get(name);
+  if (!value.IsNumber())
+    return 0;
+  double number = value.As<Napi::Number>().DoubleValue();
+  if (number < 0)
+    return 0;
+  if (number > 0xFFFF)
+    return 0xFFFF;
+  return static_cast<Uint16>(number);
+}
+
+Napi::Value SdlGameController::playHaptic(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+
+  if (info.Length() < 1 || !info[0].IsArray()) {
+    auto warning = Napi::Object::New(env);
+    warning.Set("message", "wrong argument type: keyframes must be an array");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+
+  auto pattern = std::make_shared<HapticPattern>();
+  Napi::Array keyframes = info[0].As<Napi::Array>();
+  for (uint32_t i = 0; i < keyframes.Length(); i++) {
+    Napi::Value value = keyframes.Get(i);
+    if (!value.IsObject())
+      continue;
+    Napi::Object object = value.As<Napi::Object>();
+    HapticKeyframe keyframe;
+    keyframe.low = KeyframeValue(object, "low");
+    keyframe.high = KeyframeValue(object, "high");
+    keyframe.left = KeyframeValue(object, "left");
+    keyframe.right = KeyframeValue(object, "right");
+    Napi::Value duration = object.Get("duration");
+    if (duration.IsNumber() && duration.As<Napi::Number>().DoubleValue() > 0)
+      keyframe.duration = duration.As<Napi::Number>().Uint32Value();
+    if (keyframe.left || keyframe.right)
+      pattern->triggers = true;
+    pattern->length += keyframe.duration;
+    pattern->keyframes.push_back(keyframe);
+  }
+  if (pattern->length == 0) {
+    auto warning = Napi::Object::New(env);
+    warning.Set("message", "playHaptic: the keyframes have no duration");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+
+  int playerNumber = 0;  // play on all players
+  if (info.Length() > 1 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    Napi::Value player = options.Get("player");
+    if (player.IsNumber())
+      playerNumber = player.As<Napi::Number>().Int32Value();
+    Napi::Value loop = options.Get("loop");
+    if (loop.IsBoolean() && loop.ToBoolean())
+      pattern->loops = 0;
+    else if (loop.IsNumber() && loop.As<Napi::Number>().Int32Value() > 0)
+      pattern->loops = loop.As<Napi::Number>().Int32Value();
+    Napi::Value priority = options.Get("priority");
+    if (priority.IsNumber())
+      pattern->priority = priority.As<Napi::Number>().Int32Value();
+    pattern->ramp = options.Get("ramp").ToBoolean();
+  }
+
+  int id = nextHapticId++;
+  bool playing = false;
+  for (auto &controller : controllers) {
+    if (playerNumber != 0 && controller.player != playerNumber)
+      continue;
+    if (controller.Lacks(CAP_RUMBLE) && controller.Lacks(CAP_RUMBLE_TRIGGERS))
+      continue;
+    haptics.Play(id, controller.which, controller.controller, pattern);
+    playing = true;
+  }
+  return Napi::Number::New(env, playing ? id : 0);
+}
+
+Napi::Value SdlGameController::stopHaptic(const Napi::CallbackInfo &info) {
+  int id = 0;  // stop everything
+  if (info.Length() > 0 && info[0].IsNumber())
+    id = info[0].As<Napi::Number>().Int32Value();
+  return Napi::Boolean::New(info.Env(), haptics.Cancel(id));
+}
+
+// Reads {mode, start, end, strength, amplitude, frequency}. Returns false
+// for an unknown mode.
+static bool ReadTrigger(Napi::Object object, Ds5Trigger *trigger) {
+  std::string mode = object.Get("mode").ToString().Utf8Value();
+  if (mode == "off")
+    trigger->mode = DS5_TRIGGER_OFF;
+  else if (mode == "feedback")
+    trigger->mode = DS5_TRIGGER_FEEDBACK;
+  else if (mode == "weapon")
+    trigger->mode = DS5_TRIGGER_WEAPON;
+  else if (mode == "vibration")
+    trigger->mode = DS5_TRIGGER_VIBRATION;
+  else
+    return false;
+
+  auto number = [&object](const char *name, int fallback) {
+    Napi::Value value = object.Get(name);
+    return value.IsNumber() ? value.As<Napi::Number>().Int32Value()
+                            : fallback;
+  };
+  trigger->start = number("start", 0);
+  trigger->end = number("end", 8);
+  trigger->strength = number("strength", 8);
+  trigger->amplitude = number("amplitude", 8);
+  trigger->frequency = number("frequency", 30);
+  return true;
+}
+
+Napi::Value SdlGameController::setEffects(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+  auto warn = [&](const char *message) {
+    auto warning = Napi::Object::New(env);
+    warning.Set("message", message);
+    emit({EventName(EVENT_WARNING), warning});
+  };
+
+  if (info.Length() < 1 || !info[0].IsObject()) {
+    warn("wrong argument type: effects must be an object");
+    return Napi::Number::New(env, 0);
+  }
+  int playerNumber = 0;  // set effects for all players
+  if (info.Length() > 1) {
+    if (info[1].IsNumber())
+      playerNumber = info[1].As<Napi::Number>().Int32Value();
+    else
+      warn("wrong argument type: player");
+  }
+
+  // Read everything first, so a bad field does not leave half an update
+  Napi::Object effects = info[0].As<Napi::Object>();
+  uint32_t sections = 0;
+  Ds5Trigger right, left;
+  if (effects.Get("right_trigger").IsObject()) {
+    if (ReadTrigger(effects.Get("right_trigger").As<Napi::Object>(), &right))
+      sections |= DS5_RIGHT_TRIGGER;
+    else
+      warn("unknown trigger mode: right_trigger");
+  }
+  if (effects.Get("left_trigger").IsObject()) {
+    if (ReadTrigger(effects.Get("left_trigger").As<Napi::Object>(), &left))
+      sections |= DS5_LEFT_TRIGGER;
+    else
+      warn("unknown trigger mode: left_trigger");
+  }
+
+  Uint8 led[3] = {0, 0, 0};
+  Napi::Value ledValue = effects.Get("led");
+  if (ledValue.IsArray()) {
+    Napi::Array rgb = ledValue.As<Napi::Array>();
+    for (uint32_t i = 0; i < 3 && i < rgb.Length(); i++)
+      led[i] = static_cast<Uint8>(rgb.Get(i).ToNumber().Uint32Value());
+    sections |= DS5_LED;
+  } else if (!ledValue.IsUndefined()) {
+    warn("wrong argument type: led must be [red, green, blue]");
+  }
+
+  Uint8 lights = 0;
+  Napi::Value lightsValue = effects.Get("player_lights");
+  if (lightsValue.IsNumber()) {
+    lights = static_cast<Uint8>(lightsValue.As<Napi::Number>().Uint32Value());
+    sections |= DS5_PLAYER_LIGHTS;
+  } else if (!lightsValue.IsUndefined()) {
+    warn("wrong argument type: player_lights");
+  }
+
+  Ds5MicLed mic = DS5_MIC_OFF;
+  Napi::Value micValue = effects.Get("mic_led");
+  if (!micValue.IsUndefined()) {
+    std::string mode = micValue.ToString().Utf8Value();
+    if (mode == "on")
+      mic = DS5_MIC_ON;
+    else if (mode == "pulse")
+      mic = DS5_MIC_PULSE;
+    if (mode == "off" || mic != DS5_MIC_OFF)
+      sections |= DS5_MIC_LED;
+    else
+      warn("unknown mic_led mode");
+  }
+
+  // Queued for the next poll, which sends one report per controller
+  int queued = 0;
+  for (auto &controller : controllers) {
+    if (playerNumber != 0 && controller.player != playerNumber)
+      continue;
+    // A DualSense still being probed, or whose probe failed, is sent the
+    // report and SDL reports the outcome
+    if (controller.Lacks(CAP_EFFECTS)) {
+      // Only worth an error when the controller was asked for by player
+      if (playerNumber != 0) {
+        auto obj = Napi::Object::New(env);
+        obj.Set(Key(KEY_PLAYER), controller.player);
+        obj.Set(Key(KEY_MESSAGE), "Effects are not supported");
+        obj.Set(Key(KEY_OPERATION), "setEffects");
+        emit({EventName(EVENT_ERROR), obj});
       }
+      continue;
+    }
+    Ds5Effects &ds5 = controller.ds5;
+    if (sections & DS5_RIGHT_TRIGGER)
+      ds5.SetTrigger(DS5_RIGHT_TRIGGER, right);
+    if (sections & DS5_LEFT_TRIGGER)
+      ds5.SetTrigger(DS5_LEFT_TRIGGER, left);
+    if (sections & DS5_LED)
+      ds5.SetLed(led[0], led[1], led[2]);
+    if (sections & DS5_PLAYER_LIGHTS)
+      ds5.SetPlayerLights(lights);
+    if (sections & DS5_MIC_LED)
+      ds5.SetMicLed(mic);
+    queued++;
+  }
+  return Napi::Number::New(env, queued);
+}
+
+void SdlGameController::FlushEffects(Napi::Env env, EventSink *sink) {
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+  for (auto &controller : controllers) {
+    if (controller.ds5.dirty == 0)
+      continue;
+    DS5EffectsState_t report;
+    if (!controller.ds5.Report(&report)) {
+      // The controller already shows all of it
+      controller.effectsUnchanged++;
+      continue;
+    }
+    if (SDL_GameControllerSendEffect(controller.controller, &report,
+                                     sizeof(report))
+        == 0) {
+      controller.ds5.Sent(report);
+      controller.outputs++;
+    } else {
+      auto obj = Napi::Object::New(env);
+      obj.Set(Key(KEY_MESSAGE), SDL_GetError());
+      obj.Set(Key(KEY_OPERATION), "setEffects");
+      obj.Set(Key(KEY_PLAYER), controller.player);
+      Emit(sink, EVENT_ERROR, obj);
+    }
+  }
+#else
+  (void) env;
+  (void) sink;
+#endif
+}
+
+Napi::Value SdlGameController::loadMappings(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+  auto failed = [&](const std::string &message) {
+    auto obj = Napi::Object::New(env);
+    obj.Set(Key(KEY_MESSAGE), message);
+    obj.Set(Key(KEY_OPERATION), "loadMappings");
+    emit({EventName(EVENT_ERROR), obj});
+    return Napi::Number::New(env, -1);
+  };
+
+  if (info.Length() < 1 || (!info[0].IsString() && !info[0].IsBuffer()))
+    return failed("wrong argument type: path or Buffer");
+  // Mappings added before SDL starts would be dropped when it does
+  if (!InitSdl(env, emit))
+    return failed("SDL is still starting, wait for init()");
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  MappedFile file;
+  const uint8_t *data;
+  size_t size;
+  if (info[0].IsString()) {
+    if (!file.Open(info[0].As<Napi::String>().Utf8Value()))
+      return failed(file.Error());
+    data = file.Data();
+    size = file.Size();
+  } else {
+    auto buffer = info[0].As<Napi::Buffer<uint8_t>>();
+    data = buffer.Data();
+    size = buffer.Length();
+  }
+  MappingLoad load = LoadMappings(data, size);
+
+  // SDL queued a remapped event for every mapping that changed an open
+  // controller, keep one per controller
+  std::set<SDL_JoystickID> remapped;
+  SDL_Event events[64];
+  int count;
+  while ((count = SDL_PeepEvents(events, 64, SDL_GETEVENT,
+                                 SDL_CONTROLLERDEVICEREMAPPED,
+                                 SDL_CONTROLLERDEVICEREMAPPED))
+         > 0) {
+    for (int i = 0; i < count; i++)
+      remapped.insert(events[i].cdevice.which);
+  }
+  for (auto which : remapped) {
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = SDL_CONTROLLERDEVICEREMAPPED;
+    event.cdevice.timestamp = SDL_GetTicks();
+    event.cdevice.which = which;
+    SDL_PushEvent(&event);
+  }
+
+  auto obj = Napi::Object::New(env);
+  obj.Set(Key(KEY_MESSAGE), "Game controller mappings were loaded");
+  obj.Set("entries", static_cast<double>(load.entries));
+  obj.Set("added", static_cast<double>(load.added));
+  obj.Set("updated", static_cast<double>(load.updated));
+  obj.Set("known", static_cast<double>(load.known));
+  obj.Set("other_platform", static_cast<double>(load.otherPlatform));
+  obj.Set("failed", static_cast<double>(load.failed));
+  obj.Set("remapped", static_cast<double>(remapped.size()));
+  obj.Set("elapsed_ms", static_cast<double>(SDL_GetPerformanceCounter() - start)
+                          * 1000 / SDL_GetPerformanceFrequency());
+  emit({EventName(EVENT_MAPPINGS_LOADED), obj});
+  return Napi::Number::New(env, static_cast<double>(load.added + load.updated));
+}
+
+// Reads a number between 0 and max, or fallback when there is none
+static Uint32 ReflexValue(Napi::Object object, const char *name,
+                          Uint32 fallback, Uint32 max) {
+  Napi::Value value = object.Get(name);
+  if (!value.IsNumber())
+    return fallback;
+  double number = value.As<Napi::Number>().DoubleValue();
+  if (number < 0)
+    return 0;
+  if (number > max)
+    return max;
+  return static_cast<Uint32>(number);
+}
+
+Napi::Value SdlGameController::addReflex(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+  auto warning = Napi::Object::New(env);
+  warning.Set(Key(KEY_OPERATION), "addReflex");
+
+  if (info.Length() < 1 || !info[0].IsObject()
+      || !info[0].As<Napi::Object>().Get("on").IsString()) {
+    warning.Set(Key(KEY_MESSAGE), "wrong argument type: rule.on");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+  Napi::Object options = info[0].As<Napi::Object>();
+  ReflexRule rule;
+
+  // 'a', 'a:down' and 'a:up' like the button events, or an axis name
+  std::string on = options.Get("on").As<Napi::String>().Utf8Value();
+  std::string name = on.substr(0, on.find(':'));
+  std::string edge = on.size() > name.size() ? on.substr(name.size()) : "";
+  auto button = SDL_GameControllerGetButtonFromString(name.c_str());
+  auto axis = SDL_GameControllerGetAxisFromString(name.c_str());
+  if (button != SDL_CONTROLLER_BUTTON_INVALID
+      && (edge.empty() || edge == ":down" || edge == ":up")) {
+    rule.control = button;
+    rule.pressed = edge != ":up";
+  } else if (axis != SDL_CONTROLLER_AXIS_INVALID && edge.empty()) {
+    Napi::Value above = options.Get("above");
+    Napi::Value below = options.Get("below");
+    if (!above.IsNumber() && !below.IsNumber()) {
+      warning.Set(Key(KEY_MESSAGE),
+                  "addReflex: axis rules need above or below");
+      emit({EventName(EVENT_WARNING), warning});
+      return Napi::Number::New(env, 0);
+    }
+    rule.axis = true;
+    rule.control = axis;
+    rule.rising = above.IsNumber();
+    double threshold = (rule.rising ? above : below).As<Napi::Number>();
+    rule.threshold = static_cast<Sint16>(
+      std::min(std::max(threshold, -32768.0), 32767.0));
+  } else {
+    warning.Set(Key(KEY_MESSAGE), "addReflex: unknown input: " + on);
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+
+  Napi::Value player = options.Get("player");
+  if (player.IsNumber())
+    rule.player = player.As<Napi::Number>().Int32Value();
+  Napi::Value notify = options.Get("notify");
+  if (notify.IsBoolean())
+    rule.notify = notify.ToBoolean();
+
+  // Same defaults as rumble, rumbleTriggers and setLeds
+  Napi::Value rumble = options.Get("rumble");
+  if (rumble.IsObject()) {
+    Napi::Object object = rumble.As<Napi::Object>();
+    rule.outputs |= REFLEX_RUMBLE;
+    rule.low = static_cast<Uint16>(ReflexValue(object, "low", 0xFFFC, 0xFFFF));
+    rule.high =
+      static_cast<Uint16>(ReflexValue(object, "high", 0xFFFC, 0xFFFF));
+    rule.rumbleMs = ReflexValue(object, "duration", 250, 0xFFFFFFFF);
+  }
+  Napi::Value triggers = options.Get("rumble_triggers");
+  if (triggers.IsObject()) {
+    Napi::Object object = triggers.As<Napi::Object>();
+    rule.outputs |= REFLEX_RUMBLE_TRIGGERS;
+    rule.left =
+      static_cast<Uint16>(ReflexValue(object, "left", 0xFFFC, 0xFFFF));
+    rule.right =
+      static_cast<Uint16>(ReflexValue(object, "right", 0xFFFC, 0xFFFF));
+    rule.triggersMs = ReflexValue(object, "duration", 250, 0xFFFFFFFF);
+  }
+  Napi::Value led = options.Get("led");
+  if (led.IsObject()) {
+    Napi::Object object = led.As<Napi::Object>();
+    rule.outputs |= REFLEX_LED;
+    rule.led[0] = static_cast<Uint8>(ReflexValue(object, "red", 0, 0xFF));
+    rule.led[1] = static_cast<Uint8>(ReflexValue(object, "green", 0, 0xFF));
+    rule.led[2] = static_cast<Uint8>(ReflexValue(object, "blue", 0, 0xFF));
+  }
+  if (rule.outputs == 0 && !rule.notify) {
+    warning.Set(Key(KEY_MESSAGE), "addReflex: the rule does nothing");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+
+  int id = reflexes.Add(rule);
+  UpdateWanted();
+  return Napi::Number::New(env, id);
+}
+
+Napi::Value SdlGameController::removeReflex(const Napi::CallbackInfo &info) {
+  int id = 0;  // remove every rule
+  if (info.Length() > 0 && info[0].IsNumber())
+    id = info[0].As<Napi::Number>().Int32Value();
+  bool removed = reflexes.Remove(id);
+  UpdateWanted();
+  return Napi::Boolean::New(info.Env(), removed);
+}
+
+void SdlGameController::ReflexDone(Napi::Env env, EventSink *sink,
+                                   const ReflexFired &fired) {
+  const ReflexRule &rule = fired.rule;
+  // Keep what applyOutputs and setEffects know about the outputs right
+  auto record = controllers.Find(fired.which);
+  if (record && fired.written) {
+    if (fired.written & REFLEX_RUMBLE) {
+      record->rumbleLow = rule.low;
+      record->rumbleHigh = rule.high;
+      record->rumbleExpires = rule.rumbleMs ? fired.ticks + rule.rumbleMs : 0;
+    }
+    if (fired.written & REFLEX_RUMBLE_TRIGGERS) {
+      record->triggerLeft = rule.left;
+      record->triggerRight = rule.right;
+      record->triggerExpires =
+        rule.triggersMs ? fired.ticks + rule.triggersMs : 0;
     }
+    if (fired.written & REFLEX_LED) {
+      SDL_memcpy(record->led, rule.led, sizeof(record->led));
+      record->ds5.known &= ~DS5_LED;
+    }
+    record->outputs++;
+  }
+  if (!rule.notify)
+    return;
+
+  auto obj = Napi::Object::New(env);
+  obj.Set("id", fired.id);
+  obj.Set(Key(KEY_WHICH), static_cast<int>(fired.which));
+  obj.Set(Key(KEY_PLAYER), fired.player);
+  if (rule.axis) {
+    obj.Set("axis", SDL_GameControllerGetStringForAxis(
+                      static_cast<SDL_GameControllerAxis>(rule.control)));
+    obj.Set("value", fired.value);
+  } else {
+    obj.Set(Key(KEY_BUTTON), EventName(ButtonEventId(rule.control)));
+    obj.Set("pressed", rule.pressed);
+  }
+  obj.Set("timestamp", fired.ticks);
+  if (fired.failed) {
+    std::string failed;
+    if (fired.failed & REFLEX_RUMBLE)
+      failed += "rumble ";
+    if (fired.failed & REFLEX_RUMBLE_TRIGGERS)
+      failed += "rumble_triggers ";
+    if (fired.failed & REFLEX_LED)
+      failed += "led ";
+    failed.pop_back();
+    obj.Set(Key(KEY_MESSAGE), "Reflex outputs failed: " + failed);
+  }
+  Emit(sink, EVENT_REFLEX, obj);
+}
+
+// Reads one step: a name, names joined with '+', or an array of names
+static bool ReadComboStep(Napi::Value value, std::vector<int> *step) {
+  std::vector<std::string> names;
+  if (value.IsString()) {
+    std::string text = value.As<Napi::String>().Utf8Value();
+    size_t begin = 0, plus;
+    while ((plus = text.find('+', begin)) != std::string::npos) {
+      names.push_back(text.substr(begin, plus - begin));
+      begin = plus + 1;
+    }
+    names.push_back(text.substr(begin));
+  } else if (value.IsArray()) {
+    Napi::Array array = value.As<Napi::Array>();
+    for (uint32_t i = 0; i < array.Length(); i++)
+      names.push_back(array.Get(i).ToString().Utf8Value());
+  }
+  if (names.empty() || names.size() > ComboMatcher::MAX_CHORD)
+    return false;
+  for (auto &name : names) {
+    int symbol = ComboMatcher::Symbol(name);
+    if (symbol < 0)
+      return false;
+    step->push_back(symbol);
+  }
+  return true;
+}
+
+// A time in ms, or in frames of 1/60 s
+static bool ReadComboWindow(Napi::Object options, const char *ms,
+                            const char *frames, Uint32 *window) {
+  Napi::Value value = options.Get(ms);
+  double scale = 1;
+  if (!value.IsNumber()) {
+    value = options.Get(frames);
+    scale = 1000.0 / 60;
+  }
+  if (!value.IsNumber())
+    return false;
+  double number = value.As<Napi::Number>().DoubleValue() * scale;
+  *window = number > 0 ? static_cast<Uint32>(number + 0.5) : 0;
+  return true;
+}
+
+Napi::Value SdlGameController::addCombo(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Function emit = Emitter(info);
+  auto warning = Napi::Object::New(env);
+  warning.Set(Key(KEY_OPERATION), "addCombo");
+
+  if (info.Length() < 1 || !info[0].IsArray()) {
+    warning.Set(Key(KEY_MESSAGE), "wrong argument type: steps");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+  ComboPattern pattern;
+  Napi::Array steps = info[0].As<Napi::Array>();
+  for (uint32_t i = 0; i < steps.Length(); i++) {
+    std::vector<int> step;
+    if (!ReadComboStep(steps.Get(i), &step)) {
+      warning.Set(Key(KEY_MESSAGE), "addCombo: unknown input in step "
+                                      + std::to_string(i));
+      emit({EventName(EVENT_WARNING), warning});
+      return Napi::Number::New(env, 0);
+    }
+    // A button is only pressed once, a chord that lists it twice never ends
+    std::vector<int> sorted = step;
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+      warning.Set(Key(KEY_MESSAGE), "addCombo: repeated input in step "
+                                      + std::to_string(i));
+      emit({EventName(EVENT_WARNING), warning});
+      return Napi::Number::New(env, 0);
+    }
+    pattern.steps.push_back(step);
+  }
+  if (pattern.steps.empty() || pattern.steps.size() > ComboMatcher::MAX_STEPS) {
+    warning.Set(Key(KEY_MESSAGE), "addCombo: a combo has 1 to 32 steps");
+    emit({EventName(EVENT_WARNING), warning});
+    return Napi::Number::New(env, 0);
+  }
+
+  if (info.Length() > 1 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    Napi::Value name = options.Get("name");
+    if (name.IsString())
+      pattern.name = name.As<Napi::String>().Utf8Value();
+    Napi::Value player = options.Get("player");
+    if (player.IsNumber())
+      pattern.player = player.As<Napi::Number>().Int32Value();
+    ReadComboWindow(options, "step_ms", "step_frames", &pattern.stepMs);
+    ReadComboWindow(options, "chord_ms", "chord_frames", &pattern.chordMs);
+  }
+
+  int id = combos.Add(pattern);
+  UpdateWanted();
+  return Napi::Number::New(env, id);
+}
+
+Napi::Value SdlGameController::removeCombo(const Napi::CallbackInfo &info) {
+  int id = 0;  // remove every combo
+  if (info.Length() > 0 && info[0].IsNumber())
+    id = info[0].As<Napi::Number>().Int32Value();
+  bool removed = combos.Remove(id);
+  UpdateWanted();
+  return Napi::Boolean::New(info.Env(), removed);
+}
+
+void SdlGameController::MatchCombos(Napi::Env env, EventSink *sink,
+                                    const SDL_Event &event) {
+  SDL_JoystickID which;
+  if (event.type == SDL_CONTROLLERBUTTONDOWN
+      || event.type == SDL_CONTROLLERBUTTONUP)
+    which = event.cbutton.which;
+  else if (event.type == SDL_CONTROLLERAXISMOTION)
+    which = event.caxis.which;
+  else
+    return;
+
+  int player = PlayerForInstance(which);
+  combos.Feed(event, player, &comboMatches);
+  for (auto &match : comboMatches) {
+    auto obj = Napi::Object::New(env);
+    obj.Set("id", match.id);
+    const ComboPattern *pattern = combos.Find(match.id);
+    if (pattern && !pattern->name.empty())
+      obj.Set("name", pattern->name);
+    obj.Set(Key(KEY_WHICH), static_cast<int>(which));
+    obj.Set(Key(KEY_PLAYER), player);
+    obj.Set("timestamp", match.end);
+    obj.Set("duration_ms", match.end - match.start);
+    Emit(sink, EVENT_COMBO, obj);
   }
+  comboMatches.clear();
 }
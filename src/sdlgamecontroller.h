@@ -1,39 +1,471 @@
 #pragma once
+#include "capabilitycache.h"
+#include "combomatcher.h"
+#include "controllerregistry.h"
+#include "eventhub.h"
+#include "eventtrace.h"
+#include "hapticsequencer.h"
+#include "mappedfile.h"
+#include "mappingdb.h"
+#include "reflexrules.h"
+#include "sensorfusion.h"
+#include "touchgestures.h"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_gamecontroller.h>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
 #include <map>
 #include <napi.h>  // NOLINT
 #include <set>
 #include <string>
-#include <thread>
+#include <unordered_map>
+#include <vector>
 
 constexpr size_t ARRAY_LENGTH = 10;
 
+// Shared memory event ring: a header of int32 words followed by fixed size
+// records. JS owns the tail, the addon owns the head and the drop counter.
+enum RingHeader {
+  RING_HEAD = 0,
+  RING_TAIL,
+  RING_CAPACITY,
+  RING_DROPPED,
+  RING_RECORD_SIZE,
+  RING_HEADER_WORDS = 8
+};
+
+// Record: type, which, player, code, value, timestamp, x, y, z, reserved.
+// x, y and z are float32 (touchpad position and pressure, sensor data).
+constexpr size_t RING_RECORD_WORDS = 10;
+
+enum RingEventType {
+  RING_BUTTON_DOWN = 1,
+  RING_BUTTON_UP,
+  RING_AXIS_MOTION,
+  RING_DEVICE_ADDED,
+  RING_DEVICE_REMOVED,
+  RING_DEVICE_REMAPPED,
+  RING_TOUCHPAD_DOWN,
+  RING_TOUCHPAD_MOTION,
+  RING_TOUCHPAD_UP,
+  RING_SENSOR_UPDATE,
+  RING_BATTERY_UPDATE
+};
+
+// getState snapshot: a header of int16 words followed by one record per open
+// controller. Button count depends on the SDL version, so readers should use
+// the stride from the header.
+enum StateHeader { STATE_COUNT = 0, STATE_STRIDE, STATE_HEADER_WORDS };
+
+enum StateRecord {
+  STATE_PLAYER = 0,
+  STATE_WHICH,
+  STATE_AXES,
+  STATE_BUTTONS = STATE_AXES + SDL_CONTROLLER_AXIS_MAX,
+  STATE_RECORD_WORDS = STATE_BUTTONS + SDL_CONTROLLER_BUTTON_MAX
+};
+
+// applyOutputs frame: a header of uint16 words followed by one record per
+// player with the wanted output state. Flags tell which outputs a record
+// sets, the others are left alone.
+enum OutputHeader { OUTPUT_COUNT = 0, OUTPUT_STRIDE, OUTPUT_HEADER_WORDS };
+
+enum OutputRecord {
+  OUTPUT_PLAYER = 0,
+  OUTPUT_FLAGS,
+  OUTPUT_RUMBLE_LOW,
+  OUTPUT_RUMBLE_HIGH,
+  OUTPUT_TRIGGER_LEFT,
+  OUTPUT_TRIGGER_RIGHT,
+  OUTPUT_RED,
+  OUTPUT_GREEN,
+  OUTPUT_BLUE,
+  OUTPUT_RECORD_WORDS
+};
+
+enum OutputFlags { OUTPUT_RUMBLE = 1, OUTPUT_TRIGGERS = 2, OUTPUT_LED = 4 };
+
+// What one applyOutputs call did, for its acknowledgement
+struct OutputResult {
+  int written = 0;
+  int unchanged = 0;
+  int deferred = 0;
+  int unsupported = 0;
+  int failed = 0;
+};
+
+// Every event we emit. The ones before EVENT_MASKABLE_COUNT are skipped when
+// nobody listens to them. Axis events get one id per axis, buttons get three
+// per button: "a", "a:down" and "a:up".
+enum EventId {
+  EVENT_CONTROLLER_AXIS_MOTION = 0,
+  EVENT_CONTROLLER_BUTTON_DOWN,
+  EVENT_CONTROLLER_BUTTON_UP,
+  EVENT_CONTROLLER_DEVICE_REMAPPED,
+  EVENT_CONTROLLER_TOUCHPAD_DOWN,
+  EVENT_CONTROLLER_TOUCHPAD_MOTION,
+  EVENT_CONTROLLER_TOUCHPAD_UP,
+  EVENT_CONTROLLER_SENSOR_UPDATE,
+  EVENT_GYROSCOPE,
+  EVENT_ACCELEROMETER,
+  EVENT_CONTROLLER_BATTERY_UPDATE,
+  EVENT_SENSOR_BATCH,
+  EVENT_ORIENTATION,
+  EVENT_TOUCHPAD_GESTURE,
+  EVENT_TOUCHPAD_BATCH,
+  EVENT_AXIS_FIRST,
+  EVENT_BUTTON_FIRST = EVENT_AXIS_FIRST + SDL_CONTROLLER_AXIS_MAX,
+  EVENT_MASKABLE_COUNT = EVENT_BUTTON_FIRST + 3 * SDL_CONTROLLER_BUTTON_MAX,
+  EVENT_ERROR = EVENT_MASKABLE_COUNT,
+  EVENT_WARNING,
+  EVENT_SDL_INIT,
+  EVENT_CONTROLLER_DEVICE_ADDED,
+  EVENT_CONTROLLER_DEVICE_REMOVED,
+  EVENT_BATCH,
+  EVENT_GYROSCOPE_ENABLED,
+  EVENT_GYROSCOPE_DISABLED,
+  EVENT_ACCELEROMETER_ENABLED,
+  EVENT_ACCELEROMETER_DISABLED,
+  EVENT_LED,
+  EVENT_RUMBLED,
+  EVENT_RUMBLED_TRIGGERS,
+  EVENT_REPLAY_DONE,
+  EVENT_CONTROLLER_CAPABILITIES,
+  EVENT_OUTPUTS_APPLIED,
+  EVENT_HAPTIC_DONE,
+  EVENT_MAPPINGS_LOADED,
+  EVENT_REFLEX,
+  EVENT_COMBO,
+  EVENT_ID_COUNT
+};
+
+enum ButtonAlias { BUTTON_ALIAS = 0, BUTTON_ALIAS_DOWN, BUTTON_ALIAS_UP };
+
+// Property keys and messages set on every event, created once
+enum KeyId {
+  KEY_MESSAGE = 0,
+  KEY_OPERATION,
+  KEY_EVENT,
+  KEY_BUTTON,
+  KEY_VALUE,
+  KEY_PRESSED,
+  KEY_PLAYER,
+  KEY_WHICH,
+  KEY_TIMESTAMP,
+  KEY_TOUCHPAD,
+  KEY_FINGER,
+  KEY_X,
+  KEY_Y,
+  KEY_Z,
+  KEY_PRESSURE,
+  KEY_SENSOR,
+  KEY_LEVEL,
+  KEY_AXIS_MOTION_MESSAGE,
+  KEY_BUTTON_PRESSED_MESSAGE,
+  KEY_BUTTON_RELEASED_MESSAGE,
+  KEY_TOUCHPAD_DOWN_MESSAGE,
+  KEY_TOUCHPAD_MOTION_MESSAGE,
+  KEY_TOUCHPAD_UP_MESSAGE,
+  KEY_SENSOR_MESSAGE,
+  KEY_COUNT
+};
+
+// Where HandleEvent delivers events: emitted one at a time, or collected
+// into an array that is handed to JS in a single call.
+struct EventSink {
+  Napi::Function emit;
+  Napi::Array batch;
+  uint32_t length = 0;
+  bool batching = false;
+};
+
+// Power of two histogram: bucket i counts values below 2^i, the last bucket
+// everything larger.
+constexpr int HISTOGRAM_BUCKETS = 24;
+
+struct Histogram {
+  uint64_t counts[HISTOGRAM_BUCKETS] = {};
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+
+  void Add(uint64_t value) {
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS - 1 && value >= (1ull << bucket))
+      bucket++;
+    counts[bucket]++;
+    count++;
+    sum += value;
+    if (value > max)
+      max = value;
+  }
+};
+
+// Always on counters behind getStats. Events are counted by RingEventType,
+// index 0 holds everything else.
+struct PollStats {
+  uint64_t polls = 0;
+  uint64_t events = 0;
+  uint64_t eventsByType[RING_BATTERY_UPDATE + 1] = {};
+  uint64_t unsubscribed = 0;
+  uint64_t axisCoalesced = 0;
+  uint64_t axisFiltered = 0;
+  uint64_t pollOverruns = 0;
+  Histogram eventsPerPoll;
+  Histogram pollMicros;
+  Histogram ageMicros;
+};
+
+// Sensor samples of one controller and sensor collected during a poll, as
+// timestamp_us, x, y, z. With an output rate, samples are averaged over
+// each output interval before they are added.
+struct SensorStream {
+  SDL_JoystickID which = -1;
+  int sensor = 0;
+  std::vector<double> samples;
+  double sum[3] = {0, 0, 0};
+  int count = 0;
+  double windowStart = 0;
+};
+
+// Orientation of one controller, fed at the full sensor rate
+struct FusionState {
+  explicit FusionState(float beta) : filter(beta) {}
+  SensorFusion filter;
+  double lastGyroTimestamp = 0;
+  bool updated = false;
+};
+
+class SdlInitWorker;
+
 class SdlGameController : public Napi::ObjectWrap<SdlGameController> {
  public:
   static Napi::Object Init(Napi::Env env, Napi::Object exports);
   explicit SdlGameController(const Napi::CallbackInfo &info);
+  ~SdlGameController();
 
  private:
   static Napi::FunctionReference constructor;
 
   // Node methods
   Napi::Value pollEvents(const Napi::CallbackInfo &info);
+  Napi::Value pollBatch(const Napi::CallbackInfo &info);
+  Napi::Value pendingEvents(const Napi::CallbackInfo &info);
+  Napi::Value pushEvent(const Napi::CallbackInfo &info);
+  void subscribe(const Napi::CallbackInfo &info);
+  void setFilter(const Napi::CallbackInfo &info);
+  Napi::Value attachRing(const Napi::CallbackInfo &info);
+  void detachRing(const Napi::CallbackInfo &info);
+  Napi::Value getState(const Napi::CallbackInfo &info);
+  Napi::Value getOrientation(const Napi::CallbackInfo &info);
+  Napi::Value getStats(const Napi::CallbackInfo &info);
+  Napi::Value startRecording(const Napi::CallbackInfo &info);
+  Napi::Value stopRecording(const Napi::CallbackInfo &info);
+  Napi::Value replay(const Napi::CallbackInfo &info);
+  void stopReplay(const Napi::CallbackInfo &info);
+  Napi::Value attachVirtual(const Napi::CallbackInfo &info);
+  Napi::Value setVirtual(const Napi::CallbackInfo &info);
+  void detachVirtual(const Napi::CallbackInfo &info);
+  Napi::Value startEventThread(const Napi::CallbackInfo &info);
+  void stopEventThread(const Napi::CallbackInfo &info);
   void enableGyroscope(const Napi::CallbackInfo &info);
   void enableAccelerometer(const Napi::CallbackInfo &info);
   void rumble(const Napi::CallbackInfo &info);
   void rumbleTriggers(const Napi::CallbackInfo &info);
   void setLeds(const Napi::CallbackInfo &info);
+  Napi::Value applyOutputs(const Napi::CallbackInfo &info);
+  Napi::Value playHaptic(const Napi::CallbackInfo &info);
+  Napi::Value stopHaptic(const Napi::CallbackInfo &info);
+  Napi::Value setEffects(const Napi::CallbackInfo &info);
+  Napi::Value init(const Napi::CallbackInfo &info);
+  Napi::Value loadMappings(const Napi::CallbackInfo &info);
+  Napi::Value addReflex(const Napi::CallbackInfo &info);
+  Napi::Value removeReflex(const Napi::CallbackInfo &info);
+  Napi::Value addCombo(const Napi::CallbackInfo &info);
+  Napi::Value removeCombo(const Napi::CallbackInfo &info);
 
   // Internal methods
-  bool SendEffect(SDL_GameController *gamecontroller);
+  bool InitSdl(Napi::Env env, Napi::Function emit,
+               Napi::Object *started = nullptr);
+  static bool StartSdl(const std::set<std::string> &hints);
+  Napi::Object SdlStarted(Napi::Env env, Napi::Function emit,
+                          std::chrono::steady_clock::time_point begin,
+                          bool async);
+  int DrainSdlQueue(Napi::Env env, EventSink *sink);
+  void HandleEvent(Napi::Env env, EventSink *sink, const SDL_Event &event);
+  void HandleButton(EventSink *sink, Napi::Object *obj, int button,
+                    bool pressed, int player);
+  void SetTouchpadFields(Napi::Object *obj, const SDL_Event &event);
+  void Emit(EventSink *sink, int id, Napi::Object obj);
+  void EmitAlias(EventSink *sink, int id, Napi::Object obj);
+  Napi::Function Emitter(const Napi::CallbackInfo &info);
+  static void InitStrings(Napi::Env env);
+  static Napi::String EventName(int id);
+  static Napi::String Key(KeyId id);
+  static int ButtonEventId(int button, ButtonAlias alias = BUTTON_ALIAS);
+  bool Wanted(int id) const;
+  uint32_t WantedClasses() const;
+  void UpdateWanted();
+  bool Subscribed(const SDL_Event &event) const;
+  bool WriteRing(const SDL_Event &event);
+  void DeliverEvent(Napi::Env env, EventSink *sink, const SDL_Event &event);
+  void FlushAxisEvents(Napi::Env env, EventSink *sink);
+  bool FilterAxis(SDL_Event *event);
+  void BeginPoll();
+  void FinishPoll(Napi::Env env, EventSink *sink);
+  void CountEvent(const SDL_Event &event);
+  static Napi::Object HistogramObject(Napi::Env env, const Histogram &h);
+  void StreamSensor(const SDL_Event &event);
+  void FlushSensorStreams(Napi::Env env, EventSink *sink);
+  void FuseSensor(const SDL_Event &event);
+  void FlushOrientation(Napi::Env env, EventSink *sink);
+  Napi::Object Orientation(Napi::Env env, SDL_JoystickID which,
+                           const FusionState &state);
+  void WantOutputs(ControllerRecord *controller, const uint16_t *record,
+                   Uint32 now, OutputResult *result);
+  void WriteOutputs(Napi::Env env, EventSink *sink,
+                    ControllerRecord *controller, Uint32 now,
+                    OutputResult *result);
+  void FlushOutputs(Napi::Env env, EventSink *sink);
+  void FlushEffects(Napi::Env env, EventSink *sink);
+  void ReflexDone(Napi::Env env, EventSink *sink, const ReflexFired &fired);
+  void MatchCombos(Napi::Env env, EventSink *sink, const SDL_Event &event);
+  void TrackTouch(const SDL_Event &event);
+  void FlushTouchpad(Napi::Env env, EventSink *sink);
+  static void ReadAxisOption(Napi::Object config, const char *name,
+                             Sint16 *values);
+  static HubFilter ReadFilter(Napi::Value value);
+  int PlayerForInstance(const SDL_JoystickID which);
+  void DrainEventQueue(Napi::Env env, Napi::Function emit);
+  void StopEventThread();
+  static bool SendEffect(SDL_GameController *gamecontroller);
+  static uint32_t ProbeCapabilities(SDL_GameController *gamecontroller);
+  // A probe finished, the instance updates its controllers of that model
+  void ProbeDone(Napi::Env env, const CapabilityKey &key, uint32_t caps,
+                 bool probed);
   SDL_GameController *AddController(const int device_index, Napi::Object *obj);
   void RemoveController(const SDL_JoystickID which);
   int NextPlayer();
 
   static bool sdlInit;
+  // Process wide, whoever starts SDL decides
+  static bool sdlHeadless;
+  static bool sdlEventMask;
+  // An init() still running on a worker thread. SDL is not touched from
+  // the JS thread until it is done.
+  friend class SdlInitWorker;
+  static SdlInitWorker *sdlStarting;
+  static std::unordered_map<std::string, int> eventIds;
+  static std::vector<Napi::Reference<Napi::String>> eventNames;
+  static std::vector<Napi::Reference<Napi::String>> keys;
   unsigned poll_number;
 
-  std::map<SDL_JoystickID, SDL_GameController *> gamecontrollers;
+  // Timing uses the performance counter, lined up once with SDL_GetTicks so
+  // event timestamps can be compared with it.
+  static Uint64 counterFrequency;
+  static Uint64 counterAtTick;
+  static Uint32 tickAtCounter;
+  PollStats stats;
+  Uint64 pollStart;
+  uint64_t pollEventCount;
+
+  // How much one poll may do before handing back to JS. The clock is read
+  // every pollCheckEvery events; what is left stays queued in SDL.
+  uint64_t pollBudgetMicros;
+  uint64_t pollMaxEvents;
+  uint32_t pollCheckEvery;
+  int pollPending;
+  // SDL queue overflows already warned about
+  uint64_t queueLostSeen;
+  Napi::FunctionReference emitRef;
+  bool batchMode;
+
+  // Only events with listeners are built and emitted when listenerAware
+  bool listenerAware;
+  std::bitset<EVENT_MASKABLE_COUNT> subscriptions;
+
+  // Axis noise reduction: latest value per controller and axis within a
+  // poll, plus per axis deadzone and minimum change against the last value
+  // delivered to JS.
+  bool axisCoalesce;
+  bool axisFilter;
+  Sint16 axisDeadzone[SDL_CONTROLLER_AXIS_MAX];
+  Sint16 axisThreshold[SDL_CONTROLLER_AXIS_MAX];
+  std::vector<SDL_Event> pendingAxis;
+  std::map<SDL_JoystickID, std::array<Sint16, SDL_CONTROLLER_AXIS_MAX>>
+    lastAxis;
+
+  // Sensor updates are collected into sensor-batch events when streaming
+  bool sensorStream;
+  double sensorRate;
+  std::vector<SensorStream> sensorStreams;
+
+  // Native gyroscope and accelerometer fusion into orientation quaternions
+  bool sensorFusion;
+  float fusionBeta;
+  double orientationRate;
+  Uint32 lastOrientationTicks;
+  std::map<SDL_JoystickID, FusionState> fusion;
+
+  // Touchpad events become gestures, raw samples are optionally batched as
+  // timestamp, which, touchpad, finger, state, x, y, pressure.
+  bool touchpadGestures;
+  bool touchpadRaw;
+  std::map<SDL_JoystickID, TouchGestures> touchGestures;
+  std::vector<Gesture> gestureBatch;
+  std::vector<double> touchpadSamples;
+
+  // Controller events seen by this instance can be written to a trace file,
+  // and a trace can be pushed back into the SDL queue.
+  TraceWriter recorder;
+  TraceReplayer replayer;
+
+  // Virtual game controllers for testing and benchmarks without hardware
+  std::map<SDL_JoystickID, SDL_Joystick *> virtualJoysticks;
+
+  ControllerRegistry controllers;
+
+  // Rumble support is probed off the JS thread the first time a controller
+  // model is seen and remembered on disk
+  friend class CapabilityProbe;
+  static CapabilityCache capabilityCache;
+  // Every live instance, probe results go to all of them
+  static std::set<SdlGameController *> instances;
+  // capability_cache named another file than the one in use, warned about
+  // on the first controller added
+  bool capabilityCacheConflict;
+
+  // applyOutputs writes at most once per outputInterval ms per controller,
+  // later changes wait for the next poll
+  Uint32 outputInterval;
+
+  // Uploaded rumble patterns play on the sequencer's thread
+  HapticSequencer haptics;
+  int nextHapticId;
+  std::vector<HapticDone> hapticsDone;
+  // Rules answering input with outputs on the thread that drains SDL
+  ReflexRules reflexes;
+  std::vector<ReflexFired> reflexesFired;
+  // Input sequences matched on the JS thread as events are delivered
+  ComboMatcher combos;
+  std::vector<ComboMatch> comboMatches;
   std::set<std::string> hints;
+
+  // Caller provided ring buffer, usually backed by a SharedArrayBuffer
+  Napi::Reference<Napi::Int32Array> ringRef;
+  int32_t *ringData;
+  int32_t ringCapacity;
+
+  // Events come from the shared hub. What a poll did not get to stays in
+  // eventBatch from batchIndex on and goes first next time.
+  HubConsumer hubConsumer;
+  std::vector<SDL_Event> eventBatch;
+  size_t batchIndex;
+
+  // With the event thread the hub wakes JS through a thread safe function
+  // instead of being polled from a JS timer.
+  bool eventThreadRunning;
+  Napi::ThreadSafeFunction eventThreadFn;
 };
@@ -0,0 +1,130 @@
+#include "sensorfusion.h"
+#include <cmath>
+
+namespace {
+constexpr float STANDARD_GRAVITY = 9.80665f;
+
+// Held still: gravity is all the accelerometer sees and the gyroscope
+// reads little more than its bias.
+constexpr float STILL_ACCEL_TOLERANCE = 0.5f;  // m/s^2
+constexpr float STILL_GYRO_LIMIT = 0.1f;       // rad/s
+constexpr int CALIBRATION_SAMPLES = 200;
+
+float InvSqrt(float x) { return 1.0f / std::sqrt(x); }
+
+// SDL reports x right, y up and z towards the player. The filter wants z up,
+// so use x right, y away from the player and z up.
+void ToFilterFrame(const float *data, float *out) {
+  out[0] = data[0];
+  out[1] = -data[2];
+  out[2] = data[1];
+}
+}  // namespace
+
+SensorFusion::SensorFusion(float beta) : beta(beta) { Reset(); }
+
+void SensorFusion::Reset() {
+  q[0] = 1;
+  q[1] = q[2] = q[3] = 0;
+  accel[0] = accel[1] = accel[2] = 0;
+  hasAccel = false;
+  bias[0] = bias[1] = bias[2] = 0;
+  biasSum[0] = biasSum[1] = biasSum[2] = 0;
+  stillSamples = 0;
+  calibrated = false;
+}
+
+void SensorFusion::Accelerometer(const float *data) {
+  ToFilterFrame(data, accel);
+  hasAccel = true;
+}
+
+void SensorFusion::Calibrate(const float *gyro) {
+  float a = std::sqrt(accel[0] * accel[0] + accel[1] * accel[1]
+                      + accel[2] * accel[2]);
+  float gx = gyro[0] - bias[0];
+  float gy = gyro[1] - bias[1];
+  float gz = gyro[2] - bias[2];
+  float g = std::sqrt(gx * gx + gy * gy + gz * gz);
+
+  if (!hasAccel || std::fabs(a - STANDARD_GRAVITY) > STILL_ACCEL_TOLERANCE
+      || g > STILL_GYRO_LIMIT) {
+    // Moving, start over
+    biasSum[0] = biasSum[1] = biasSum[2] = 0;
+    stillSamples = 0;
+    return;
+  }
+
+  for (int i = 0; i < 3; i++)
+    biasSum[i] += gyro[i];
+  if (++stillSamples < CALIBRATION_SAMPLES)
+    return;
+
+  // Every stretch of stillness refreshes the bias, it drifts with temperature
+  for (int i = 0; i < 3; i++) {
+    bias[i] = biasSum[i] / stillSamples;
+    biasSum[i] = 0;
+  }
+  stillSamples = 0;
+  calibrated = true;
+}
+
+void SensorFusion::Gyroscope(const float *data, float dt) {
+  float gyro[3];
+  ToFilterFrame(data, gyro);
+  Calibrate(gyro);
+  if (dt <= 0)
+    return;
+
+  float gx = gyro[0] - bias[0];
+  float gy = gyro[1] - bias[1];
+  float gz = gyro[2] - bias[2];
+  float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
+  // Rate of change of the quaternion from the gyroscope
+  float qDot0 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+  float qDot1 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+  float qDot2 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+  float qDot3 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+  float ax = accel[0], ay = accel[1], az = accel[2];
+  if (hasAccel && !(ax == 0.0f && ay == 0.0f && az == 0.0f)) {
+    float norm = InvSqrt(ax * ax + ay * ay + az * az);
+    ax *= norm;
+    ay *= norm;
+    az *= norm;
+
+    // Gradient descent step towards the measured direction of gravity
+    float _2q0 = 2.0f * q0, _2q1 = 2.0f * q1, _2q2 = 2.0f * q2;
+    float _2q3 = 2.0f * q3, _4q0 = 4.0f * q0, _4q1 = 4.0f * q1;
+    float _4q2 = 4.0f * q2, _8q1 = 8.0f * q1, _8q2 = 8.0f * q2;
+    float q0q0 = q0 * q0, q1q1 = q1 * q1, q2q2 = q2 * q2, q3q3 = q3 * q3;
+
+    float s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+    float s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1
+               + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+    float s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2
+               + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+    float s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+
+    float sNorm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+    if (sNorm > 0) {
+      sNorm = InvSqrt(sNorm);
+      qDot0 -= beta * s0 * sNorm;
+      qDot1 -= beta * s1 * sNorm;
+      qDot2 -= beta * s2 * sNorm;
+      qDot3 -= beta * s3 * sNorm;
+    }
+  }
+
+  q0 += qDot0 * dt;
+  q1 += qDot1 * dt;
+  q2 += qDot2 * dt;
+  q3 += qDot3 * dt;
+
+  float norm = InvSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+  q[0] = q0 * norm;
+  q[1] = q1 * norm;
+  q[2] = q2 * norm;
+  q[3] = q3 * norm;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+// Orientation from gyroscope and accelerometer samples using Madgwick's
+// gradient descent filter. Samples are passed as reported by SDL: gyroscope
+// in rad/s, accelerometer in m/s^2. The quaternion and gyro bias use x right,
+// y away from the player and z up.
+class SensorFusion {
+ public:
+  explicit SensorFusion(float beta = 0.1f);
+
+  // Latest accelerometer sample, used by the next gyroscope update
+  void Accelerometer(const float *data);
+
+  // Integrate one gyroscope sample taken dt seconds after the previous one
+  void Gyroscope(const float *data, float dt);
+
+  void Reset();
+  bool Calibrated() const { return calibrated; }
+  const float *Quaternion() const { return q; }
+  const float *GyroBias() const { return bias; }
+
+ private:
+  void Calibrate(const float *gyro);
+
+  float beta;
+  float q[4];  // w, x, y, z
+  float accel[3];
+  bool hasAccel;
+
+  // Gyro bias, averaged while the controller is held still
+  float bias[3];
+  float biasSum[3];
+  int stillSamples;
+  bool calibrated;
+};
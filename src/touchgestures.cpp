@@ -0,0 +1,233 @@
+#include "touchgestures.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Distances are in normalized touchpad coordinates
+constexpr uint32_t TAP_MAX_MS = 250;
+constexpr float TAP_MAX_TRAVEL = 0.03f;
+constexpr uint32_t SWIPE_MAX_MS = 800;
+constexpr float SWIPE_MIN_DISTANCE = 0.15f;
+constexpr float PINCH_START = 0.05f;
+constexpr float SCROLL_START = 0.03f;
+
+// Bounds for bad input, real pads have one or two fingers on one touchpad
+constexpr int MAX_TOUCHPADS = 4;
+constexpr int MAX_FINGERS = 8;
+constexpr size_t MAX_SAMPLES = 256;
+
+float Distance(float x0, float y0, float x1, float y1) {
+  return std::hypot(x1 - x0, y1 - y0);
+}
+}  // namespace
+
+TouchGestures::FingerTrack *TouchGestures::Track(int touchpad, int finger) {
+  if (touchpad < 0 || touchpad >= MAX_TOUCHPADS || finger < 0
+      || finger >= MAX_FINGERS)
+    return nullptr;
+
+  if (pads.size() <= static_cast<size_t>(touchpad))
+    pads.resize(touchpad + 1);
+  auto &fingers = pads[touchpad].fingers;
+  if (fingers.size() <= static_cast<size_t>(finger))
+    fingers.resize(finger + 1);
+  return &fingers[finger];
+}
+
+bool TouchGestures::TwoFingers(const Touchpad &pad, float *x, float *y,
+                               float *spread) const {
+  const TouchSample *points[2];
+  int found = 0;
+  for (auto &track : pad.fingers) {
+    if (track.down && !track.samples.empty()) {
+      points[found++] = &track.samples.back();
+      if (found == 2)
+        break;
+    }
+  }
+  if (found < 2)
+    return false;
+
+  *x = (points[0]->x + points[1]->x) / 2;
+  *y = (points[0]->y + points[1]->y) / 2;
+  *spread = Distance(points[0]->x, points[0]->y, points[1]->x, points[1]->y);
+  return true;
+}
+
+void TouchGestures::Down(int touchpad, int finger, float x, float y,
+                         uint32_t time) {
+  FingerTrack *track = Track(touchpad, finger);
+  if (track == nullptr)
+    return;
+
+  Touchpad &pad = pads[touchpad];
+  if (pad.active == 0) {
+    // First finger of a new touch
+    pad.start = time;
+    pad.maxFingers = 0;
+    pad.travel = 0;
+    pad.mode = MODE_NONE;
+  }
+  if (!track->down)
+    pad.active++;
+  pad.maxFingers = std::max(pad.maxFingers, pad.active);
+
+  track->down = true;
+  track->samples.clear();
+  track->samples.push_back({x, y, time});
+
+  if (pad.active == 2 && pad.mode == MODE_NONE) {
+    TwoFingers(pad, &pad.startX, &pad.startY, &pad.startSpread);
+    pad.lastX = pad.startX;
+    pad.lastY = pad.startY;
+  }
+}
+
+void TouchGestures::Motion(int touchpad, int finger, float x, float y,
+                           uint32_t time) {
+  FingerTrack *track = Track(touchpad, finger);
+  if (track == nullptr || !track->down)
+    return;
+
+  // Long touches keep where they started and the most recent samples
+  if (track->samples.size() >= MAX_SAMPLES) {
+    track->samples.erase(track->samples.begin() + 1,
+                         track->samples.begin() + MAX_SAMPLES / 2);
+  }
+  track->samples.push_back({x, y, time});
+
+  Touchpad &pad = pads[touchpad];
+  const TouchSample &first = track->samples.front();
+  pad.travel = std::max(pad.travel, Distance(first.x, first.y, x, y));
+
+  if (pad.active != 2 || pad.mode == MODE_DONE)
+    return;
+
+  float cx, cy, spread;
+  if (!TwoFingers(pad, &cx, &cy, &spread))
+    return;
+
+  if (pad.mode == MODE_NONE) {
+    if (std::fabs(spread - pad.startSpread) > PINCH_START)
+      pad.mode = MODE_PINCH;
+    else if (Distance(pad.startX, pad.startY, cx, cy) > SCROLL_START)
+      pad.mode = MODE_SCROLL;
+    else
+      return;
+  }
+
+  Gesture gesture = {};
+  gesture.touchpad = touchpad;
+  gesture.fingers = 2;
+  gesture.x = cx;
+  gesture.y = cy;
+  gesture.scale = 1;
+  gesture.duration = time - pad.start;
+  if (pad.mode == MODE_PINCH) {
+    gesture.type = GESTURE_PINCH;
+    if (pad.startSpread > 0)
+      gesture.scale = spread / pad.startSpread;
+  } else {
+    gesture.type = GESTURE_SCROLL;
+    gesture.dx = cx - pad.lastX;
+    gesture.dy = cy - pad.lastY;
+  }
+  pad.lastX = cx;
+  pad.lastY = cy;
+  Queue(gesture);
+}
+
+void TouchGestures::Up(int touchpad, int finger, float x, float y,
+                       uint32_t time) {
+  FingerTrack *track = Track(touchpad, finger);
+  if (track == nullptr || !track->down)
+    return;
+
+  track->samples.push_back({x, y, time});
+  Touchpad &pad = pads[touchpad];
+  const TouchSample &first = track->samples.front();
+  pad.travel = std::max(pad.travel, Distance(first.x, first.y, x, y));
+
+  if (pad.mode == MODE_PINCH || pad.mode == MODE_SCROLL) {
+    // Lifting either finger finishes a two finger gesture
+    Gesture gesture = {};
+    gesture.type = pad.mode == MODE_PINCH ? GESTURE_PINCH : GESTURE_SCROLL;
+    gesture.touchpad = touchpad;
+    gesture.fingers = 2;
+    gesture.x = pad.lastX;
+    gesture.y = pad.lastY;
+    gesture.scale = 1;
+    float spread;
+    if (pad.mode == MODE_PINCH && pad.startSpread > 0
+        && TwoFingers(pad, &gesture.x, &gesture.y, &spread))
+      gesture.scale = spread / pad.startSpread;
+    gesture.duration = time - pad.start;
+    gesture.end = true;
+    Queue(gesture);
+    pad.mode = MODE_DONE;
+  }
+
+  track->down = false;
+  pad.active--;
+  if (pad.active == 0)
+    Recognize(touchpad, &pad, track->samples, time);
+}
+
+void TouchGestures::Recognize(int touchpad, Touchpad *pad,
+                              const std::vector<TouchSample> &samples,
+                              uint32_t time) {
+  // Pinch and scroll have already been reported
+  if (pad->mode != MODE_NONE)
+    return;
+
+  const TouchSample &first = samples.front();
+  const TouchSample &last = samples.back();
+  Gesture gesture = {};
+  gesture.touchpad = touchpad;
+  gesture.fingers = pad->maxFingers;
+  gesture.x = first.x;
+  gesture.y = first.y;
+  gesture.scale = 1;
+  gesture.duration = time - pad->start;
+
+  if (pad->travel <= TAP_MAX_TRAVEL && gesture.duration <= TAP_MAX_MS) {
+    gesture.type = GESTURE_TAP;
+    Queue(gesture);
+    return;
+  }
+
+  gesture.dx = last.x - first.x;
+  gesture.dy = last.y - first.y;
+  if (pad->maxFingers == 1 && gesture.duration <= SWIPE_MAX_MS
+      && std::hypot(gesture.dx, gesture.dy) >= SWIPE_MIN_DISTANCE) {
+    gesture.type = GESTURE_SWIPE;
+    Queue(gesture);
+  }
+}
+
+void TouchGestures::Queue(const Gesture &gesture) {
+  bool continuous =
+    gesture.type == GESTURE_PINCH || gesture.type == GESTURE_SCROLL;
+  if (continuous && !gesture.end) {
+    // Merge with the pending update of the same touchpad, if any
+    for (auto pending = gestures.rbegin(); pending != gestures.rend();
+         pending++) {
+      if (pending->touchpad != gesture.touchpad)
+        continue;
+      if (pending->type != gesture.type || pending->end)
+        break;
+      float dx = pending->dx + gesture.dx;
+      float dy = pending->dy + gesture.dy;
+      *pending = gesture;
+      pending->dx = dx;
+      pending->dy = dy;
+      return;
+    }
+  }
+  gestures.push_back(gesture);
+}
+
+void TouchGestures::Take(std::vector<Gesture> *out) {
+  out->insert(out->end(), gestures.begin(), gestures.end());
+  gestures.clear();
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+enum GestureType { GESTURE_TAP, GESTURE_SWIPE, GESTURE_PINCH, GESTURE_SCROLL };
+
+// A recognized gesture. Positions are normalized to 0..1 like SDL touchpad
+// coordinates. Pinch and scroll are reported while they happen, end is set
+// on the last report when a finger is lifted.
+struct Gesture {
+  GestureType type;
+  int touchpad;
+  int fingers;
+  float x, y;    // where it happened, the centroid for two fingers
+  float dx, dy;  // swipe distance, or scroll since the previous report
+  float scale;   // pinch spread relative to the start
+  uint32_t duration;
+  bool end;
+};
+
+struct TouchSample {
+  float x, y;
+  uint32_t time;
+};
+
+// Keeps a track of samples per touchpad and finger of one controller and
+// turns them into taps, swipes, pinches and two finger scrolls.
+class TouchGestures {
+ public:
+  void Down(int touchpad, int finger, float x, float y, uint32_t time);
+  void Motion(int touchpad, int finger, float x, float y, uint32_t time);
+  void Up(int touchpad, int finger, float x, float y, uint32_t time);
+
+  // Hand over what was recognized since the last call. Pinch and scroll
+  // updates in between are merged into one.
+  void Take(std::vector<Gesture> *out);
+
+ private:
+  enum Mode { MODE_NONE, MODE_PINCH, MODE_SCROLL, MODE_DONE };
+
+  struct FingerTrack {
+    bool down = false;
+    std::vector<TouchSample> samples;
+  };
+
+  struct Touchpad {
+    std::vector<FingerTrack> fingers;
+    int active = 0;
+    int maxFingers = 0;
+    uint32_t start = 0;
+    float travel = 0;  // furthest any finger moved during this touch
+    Mode mode = MODE_NONE;
+    float startSpread = 0;
+    float startX = 0, startY = 0;
+    float lastX = 0, lastY = 0;
+  };
+
+  FingerTrack *Track(int touchpad, int finger);
+  bool TwoFingers(const Touchpad &pad, float *x, float *y,
+                  float *spread) const;
+  void Recognize(int touchpad, Touchpad *pad,
+                 const std::vector<TouchSample> &samples, uint32_t time);
+  void Queue(const Gesture &gesture);
+
+  std::vector<Touchpad> pads;
+  std::vector<Gesture> gestures;
+};
@@ -0,0 +1,140 @@
+import gamecontroller from 'sdl2-gamecontroller';
+import { writeFileSync } from 'fs';
+
+// Headless end to end benchmark. Creates SDL virtual game controllers, moves
+// their sticks and buttons at a fixed rate and measures what arrives at the
+// listeners. Needs SDL 2.0.14 and no display or hardware:
+//
+//   node build/benchmark.js --controllers 4 --rate 1000 --seconds 10 --out results.json
+//
+// Results are printed as JSON so runs against different releases can be
+// compared. Sensors are not covered, SDL 2 virtual joysticks have none.
+process.env.SDL_VIDEODRIVER ??= 'dummy';
+
+function option(name: string, fallback: number): number {
+  const index = process.argv.indexOf(`--${name}`);
+  return index > 0 ? Number(process.argv[index + 1]) : fallback;
+}
+const outIndex = process.argv.indexOf('--out');
+const out = outIndex > 0 ? process.argv[outIndex + 1] : undefined;
+
+const config = {
+  controllers: option('controllers', 4),
+  rate: option('rate', 1000), // updates per second per controller
+  seconds: option('seconds', 10),
+  poll_ms: option('poll', 1),
+};
+
+let sdl: Record<string, unknown> = {};
+gamecontroller.on('sdl-init', (data) => (sdl = data));
+gamecontroller.on('error', (data) => console.error('error', data));
+gamecontroller.on('warning', (data) => console.error('warning', data));
+
+// Players are handed out in attach order
+const players: number[] = [];
+gamecontroller.on('controller-device-added', (data) => players.push(data.player));
+
+// Axis values double as sequence numbers to match events to updates
+const sent: Map<number, bigint>[] = [];
+const latencies: number[] = [];
+let received = 0;
+
+gamecontroller.on('leftx', (data) => {
+  received++;
+  const controller = players.indexOf(data.player);
+  const start = sent[controller]?.get(data.value);
+  if (start !== undefined) {
+    latencies.push(Number(process.hrtime.bigint() - start) / 1000);
+    sent[controller].delete(data.value);
+  }
+});
+gamecontroller.on('a', () => received++);
+
+// Poll much faster than the default timer
+const poller = setInterval(() => gamecontroller.pollEvents(), config.poll_ms);
+
+const ids: number[] = [];
+for (let i = 0; i < config.controllers; i++) {
+  const id = gamecontroller.attachVirtual();
+  if (id < 0) {
+    console.error('could not attach a virtual controller');
+    process.exit(1);
+  }
+  ids.push(id);
+  sent.push(new Map());
+}
+
+function percentile(sorted: number[], p: number) {
+  if (sorted.length === 0) return 0;
+  return sorted[Math.min(sorted.length - 1, Math.floor((sorted.length * p) / 100))];
+}
+
+function run() {
+  if (players.length < ids.length) {
+    console.error('virtual controllers were attached but not opened');
+    process.exit(1);
+  }
+
+  global.gc?.();
+  const heapStart = process.memoryUsage().heapUsed;
+  const cpuStart = process.cpuUsage();
+  const start = process.hrtime.bigint();
+  let updates = 0;
+  let sequence = 0;
+
+  const driver = setInterval(() => {
+    const elapsed = Number(process.hrtime.bigint() - start) / 1e9;
+    const due = Math.floor(elapsed * config.rate);
+    for (; updates < due; updates++) {
+      sequence = (sequence % 32000) + 1;
+      ids.forEach((id, controller) => {
+        // Every fourth update is a button, the rest move the stick
+        if (updates % 4 === 3) {
+          gamecontroller.setVirtual(id, 'a', (updates >> 2) & 1);
+        } else {
+          sent[controller].set(sequence, process.hrtime.bigint());
+          gamecontroller.setVirtual(id, 'leftx', sequence);
+        }
+      });
+    }
+  }, 1);
+
+  setTimeout(() => {
+    clearInterval(driver);
+    // Let the last updates arrive
+    setTimeout(() => {
+      clearInterval(poller);
+      const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+      const cpu = process.cpuUsage(cpuStart);
+      global.gc?.();
+      const heapGrowth = process.memoryUsage().heapUsed - heapStart;
+      latencies.sort((a, b) => a - b);
+
+      const results = {
+        node: process.version,
+        sdl,
+        config,
+        updates_sent: updates * ids.length,
+        events_received: received,
+        events_per_second: Math.round(received / seconds),
+        latency_us: {
+          p50: Math.round(percentile(latencies, 50)),
+          p95: Math.round(percentile(latencies, 95)),
+          p99: Math.round(percentile(latencies, 99)),
+          max: Math.round(latencies[latencies.length - 1] ?? 0),
+        },
+        cpu_us_per_event: received ? +((cpu.user + cpu.system) / received).toFixed(2) : 0,
+        heap_growth_bytes: heapGrowth,
+      };
+
+      const json = JSON.stringify(results, null, 2);
+      console.log(json);
+      if (out) writeFileSync(out, json + '\n');
+      ids.forEach((id) => gamecontroller.detachVirtual(id));
+      process.exit(0);
+    }, 100);
+  }, config.seconds * 1000);
+}
+
+// Give SDL a moment to report the new controllers
+setTimeout(run, 500);
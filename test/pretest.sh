@@ -8,4 +8,4 @@ npm pack
 popd
 npm i ../sdl2-gamecontroller-*.tgz
 rm -rf build
-npx tsc --outDir build helloworld.ts helloworld-custom.ts lengthy.ts
+npx tsc --outDir build helloworld.ts helloworld-custom.ts lengthy.ts bench-dispatch.ts benchmark.ts